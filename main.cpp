@@ -2,15 +2,196 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <cmath>
+#include <cstdint>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <mutex>
 
 using namespace std;
 
-#define BOT_DEBUG 0
-#define INPUT_DEBUG 0
-#define RECYCLER_DEBUG 0
-#define SPAWN_DEBUG 0
-#define EXPAND_DEBUG 0
-#define TERRITORY_DEBUG 0
+/*=======================================================================
+||                               Tracing                               ||
+=======================================================================*/
+// Runtime trace channels, picked with BOT_TRACE=input,territory,... (or
+// "all") in the environment. Disabled channels cost one mask test. Events
+// go to a per-thread ring buffer, which only its own thread writes, and
+// are written to cerr in one block by trace_flush at the end of a turn.
+// Planner workers flush their own ring before they exit.
+enum TraceChannel
+{
+	TRACE_BOT,
+	TRACE_INPUT,
+	TRACE_RECYCLER,
+	TRACE_SPAWN,
+	TRACE_EXPAND,
+	TRACE_TERRITORY,
+	TRACE_PHASES,
+	TRACE_CHANNEL_COUNT
+};
+
+const char *trace_channel_names[TRACE_CHANNEL_COUNT] = {"bot", "input", "recycler", "spawn", "expand", "territory", "phases"};
+
+enum TracePhase
+{
+	PHASE_READ_INPUTS,
+	PHASE_TERITORIES,
+	PHASE_EXPAND,
+	PHASE_SPLATOON,
+	PHASE_PLANNER,
+	PHASE_EXECUTE,
+	PHASE_COUNT
+};
+
+const char *trace_phase_names[PHASE_COUNT] = {"read_inputs", "get_teritories", "expand", "splatoon", "planner", "execute_actions"};
+
+#define TRACE_RING_SIZE 4096
+
+unsigned trace_mask = 0;
+
+inline bool tracing(TraceChannel channel)
+{
+	return trace_mask & (1u << channel);
+}
+
+void trace_configure(const char *channels)
+{
+	trace_mask = 0;
+	if (channels == NULL)
+		return;
+	string list = string(",") + channels + ",";
+	for (int c = 0; c < TRACE_CHANNEL_COUNT; c++)
+	{
+		if (list.find(string(",") + trace_channel_names[c] + ",") != string::npos || list == ",all,")
+			trace_mask |= 1u << c;
+	}
+}
+
+class TraceEvent
+{
+public:
+	const char *label;
+	int8_t channel;
+	int a;
+	int b;
+	int c;
+};
+
+class TraceRing
+{
+public:
+	TraceEvent events[TRACE_RING_SIZE];
+	long long head;
+	long long phase_calls[PHASE_COUNT];
+	long long phase_ns[PHASE_COUNT];
+	TraceRing()
+	{
+		head = 0;
+		fill(phase_calls, phase_calls + PHASE_COUNT, 0);
+		fill(phase_ns, phase_ns + PHASE_COUNT, 0);
+	}
+};
+
+thread_local TraceRing trace_ring;
+
+// Phase totals of every thread, folded in by trace_flush; the lock also
+// keeps the blocks of different threads apart on cerr
+mutex trace_lock;
+long long trace_phase_calls[PHASE_COUNT];
+long long trace_phase_ns[PHASE_COUNT];
+
+void trace(TraceChannel channel, const char *label, int a = 0, int b = 0, int c = 0)
+{
+	TraceEvent &event = trace_ring.events[trace_ring.head++ % TRACE_RING_SIZE];
+	event.label = label;
+	event.channel = channel;
+	event.a = a;
+	event.b = b;
+	event.c = c;
+}
+
+// Times a phase and counts its calls while the phases channel is on
+class TraceScope
+{
+public:
+	TracePhase phase;
+	bool active;
+	chrono::steady_clock::time_point start;
+	TraceScope(TracePhase phase)
+	{
+		this->phase = phase;
+		active = tracing(TRACE_PHASES);
+		if (active)
+			start = chrono::steady_clock::now();
+	}
+	~TraceScope()
+	{
+		if (!active)
+			return;
+		long long ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+		trace_ring.phase_calls[phase]++;
+		trace_ring.phase_ns[phase] += ns;
+		trace(TRACE_PHASES, trace_phase_names[phase], ns / 1000);
+	}
+};
+
+// Writes the events of this turn (the newest TRACE_RING_SIZE of them)
+void trace_flush()
+{
+	if (trace_ring.head == 0)
+		return;
+	ostringstream out;
+	long long first = max(0LL, trace_ring.head - TRACE_RING_SIZE);
+	if (first > 0)
+		out << "[trace] " << first << " events dropped\n";
+	for (long long i = first; i < trace_ring.head; i++)
+	{
+		TraceEvent &event = trace_ring.events[i % TRACE_RING_SIZE];
+		out << "[" << trace_channel_names[event.channel] << "] " << event.label << " " << event.a << " " << event.b << " " << event.c << "\n";
+	}
+	string text = out.str();
+	lock_guard<mutex> lock(trace_lock);
+	for (int p = 0; p < PHASE_COUNT; p++)
+	{
+		trace_phase_calls[p] += trace_ring.phase_calls[p];
+		trace_phase_ns[p] += trace_ring.phase_ns[p];
+		trace_ring.phase_calls[p] = 0;
+		trace_ring.phase_ns[p] = 0;
+	}
+	cerr.write(text.data(), text.size());
+	cerr.flush();
+	trace_ring.head = 0;
+}
+
+// Per-phase totals of all threads since the start, as far as flushed
+void trace_report()
+{
+	if (!tracing(TRACE_PHASES))
+		return;
+	ostringstream out;
+	lock_guard<mutex> lock(trace_lock);
+	for (int p = 0; p < PHASE_COUNT; p++)
+	{
+		if (trace_phase_calls[p] > 0)
+			out << "[phases] " << trace_phase_names[p] << ": " << trace_phase_calls[p] << " calls, " << trace_phase_ns[p] / 1000 << " us\n";
+	}
+	string text = out.str();
+	cerr.write(text.data(), text.size());
+	cerr.flush();
+}
 
 /*=======================================================================
 ||                                                                     ||
@@ -44,22 +225,6 @@ Player convertToPlayer(int p)
 	}
 }
 
-string playerToType(Player &p)
-{
-	if (p == PLAYER_ME)
-	{
-		return "ME";
-	}
-	else if (p == PLAYER_OPPONENT)
-	{
-		return "OPPONENT";
-	}
-	else
-	{
-		return "NONE";
-	}
-}
-
 /*=======================================================================
 ||                                Mode                                ||
 =======================================================================*/
@@ -165,1510 +330,3295 @@ public:
 };
 
 /*=======================================================================
-||                                 Bot                                 ||w
+||                               CellSet                               ||
 =======================================================================*/
-class Bot
+#define MAX_WIDTH 24
+#define MAX_HEIGHT 12
+#define MAX_CASES (MAX_WIDTH * MAX_HEIGHT)
+
+#define CELL_WORDS ((MAX_CASES + 63) / 64)
+
+// One bit per cell of the largest map, indexed like Grid
+class CellSet
 {
 public:
-	Position pos;
-	Position from;
-	Player owner;
-	Bot(Position pos, Player owner)
-	{
-		this->pos = pos;
-		this->from = pos;
-		this->owner = owner;
-		if (BOT_DEBUG)
-			cerr << "Bot created at " << pos.x << " " << pos.y << " for: " << playerToType(owner) << endl;
-	}
-	Bot(const Bot &other)
-	{
-		*this = other;
-	}
-	Bot &operator=(const Bot &other)
+	uint64_t words[CELL_WORDS];
+	CellSet()
 	{
-		pos = other.pos;
-		from = other.from;
-		owner = other.owner;
-		return *this;
+		clear();
 	}
-	int distance(Bot &other)
+	void clear()
 	{
-		return pos.distance(other.pos);
+		fill(words, words + CELL_WORDS, 0);
 	}
-};
-
-/*=======================================================================
-||                               Actions                               ||
-=======================================================================*/
-class AAction
-{
-public:
-	virtual string extractString() = 0;
-	virtual int matterRemove() = 0;
-};
-
-class ActionMove : public AAction
-{
-public:
-	Position from;
-	Position to;
-	int amount_of_units;
-	ActionMove(Position from, Position to, int amount_of_units)
+	void set(int index)
 	{
-		this->from = from;
-		this->to = to;
-		this->amount_of_units = amount_of_units;
+		words[index >> 6] |= 1ULL << (index & 63);
 	}
-	string extractString()
+	void reset(int index)
 	{
-		return "MOVE " + to_string(amount_of_units) + " " + to_string(from.x) + " " + to_string(from.y) + " " + to_string(to.x) + " " + to_string(to.y);
+		words[index >> 6] &= ~(1ULL << (index & 63));
 	}
-	int matterRemove()
+	bool test(int index) const
 	{
-		return 0;
+		return (words[index >> 6] >> (index & 63)) & 1;
 	}
-};
-
-class ActionBuildRecycler : public AAction
-{
-public:
-	Position pos;
-	ActionBuildRecycler(Position pos)
+	int count() const
 	{
-		this->pos = pos;
+		int result = 0;
+		for (int w = 0; w < CELL_WORDS; w++)
+			result += __builtin_popcountll(words[w]);
+		return result;
 	}
-	string extractString()
+	bool empty() const
 	{
-		return "BUILD " + to_string(pos.x) + " " + to_string(pos.y);
+		for (int w = 0; w < CELL_WORDS; w++)
+		{
+			if (words[w])
+				return false;
+		}
+		return true;
 	}
-	int matterRemove()
+	// First set index strictly after `index`, or -1
+	int next(int index) const
 	{
-		return 10;
+		index++;
+		int w = index >> 6;
+		if (w >= CELL_WORDS)
+			return -1;
+		uint64_t word = words[w] & (~0ULL << (index & 63));
+		while (word == 0)
+		{
+			if (++w >= CELL_WORDS)
+				return -1;
+			word = words[w];
+		}
+		return (w << 6) + __builtin_ctzll(word);
 	}
-};
-
-class ActionSpawn : public AAction
-{
-public:
-	Position pos;
-	int amount_of_units;
-	ActionSpawn(Position pos, int amount_of_units)
+	int first() const
 	{
-		this->pos = pos;
-		this->amount_of_units = amount_of_units;
+		return next(-1);
 	}
-	string extractString()
+	CellSet &operator|=(const CellSet &other)
 	{
-		return "SPAWN " + to_string(amount_of_units) + " " + to_string(pos.x) + " " + to_string(pos.y);
+		for (int w = 0; w < CELL_WORDS; w++)
+			words[w] |= other.words[w];
+		return *this;
 	}
-	int matterRemove()
+	CellSet &operator&=(const CellSet &other)
 	{
-		return 10;
+		for (int w = 0; w < CELL_WORDS; w++)
+			words[w] &= other.words[w];
+		return *this;
 	}
-};
-
-class ActionMessage : public AAction
-{
-public:
-	string message;
-	ActionMessage(string message)
+	CellSet &operator-=(const CellSet &other)
 	{
-		this->message = message;
+		for (int w = 0; w < CELL_WORDS; w++)
+			words[w] &= ~other.words[w];
+		return *this;
 	}
-	string extractString()
+	bool operator==(const CellSet &other) const
 	{
-		return "MESSAGE " + message;
+		for (int w = 0; w < CELL_WORDS; w++)
+		{
+			if (words[w] != other.words[w])
+				return false;
+		}
+		return true;
 	}
-	int matterRemove()
+	// Every index moved by `n` (negative moves down), bits past the ends dropped
+	CellSet shifted(int n) const
 	{
-		return 0;
+		CellSet result;
+		int word_shift = (n < 0 ? -n : n) >> 6;
+		int bit_shift = (n < 0 ? -n : n) & 63;
+		for (int w = 0; w < CELL_WORDS; w++)
+		{
+			int src = n >= 0 ? w - word_shift : w + word_shift;
+			if (src < 0 || src >= CELL_WORDS)
+				continue;
+			if (n >= 0)
+			{
+				result.words[w] = words[src] << bit_shift;
+				if (bit_shift && src > 0)
+					result.words[w] |= words[src - 1] >> (64 - bit_shift);
+			}
+			else
+			{
+				result.words[w] = words[src] >> bit_shift;
+				if (bit_shift && src < CELL_WORDS - 1)
+					result.words[w] |= words[src + 1] << (64 - bit_shift);
+			}
+		}
+		return result;
 	}
 };
 
+CellSet operator|(CellSet a, const CellSet &b)
+{
+	return a |= b;
+}
+
+CellSet operator&(CellSet a, const CellSet &b)
+{
+	return a &= b;
+}
+
+CellSet operator-(CellSet a, const CellSet &b)
+{
+	return a -= b;
+}
+
 /*=======================================================================
-||                       ActionManager prototype                       ||
+||                           Map dimensions                            ||
 =======================================================================*/
-class Game;
-class ActionManager
+// Map size as seen by the forward-model kernels. Maps are always twice as
+// wide as tall, so FixedDims<2h, h> covers every size the referee sends and
+// lets the compiler fold the row stride and bounds into the hot loops.
+template <int W, int H>
+class FixedDims
 {
 public:
-	vector<AAction *> actions;
-	ActionManager();
-	void addAction(Game *game, AAction *action);
-	void execute();
+	static const int width = W;
+	static const int height = H;
+	static const int size = W * H;
+	FixedDims(int, int) {}
 };
 
-/*=======================================================================
-||                           Game prototype                            ||
-=======================================================================*/
-class Teritory;
-class Game
+// Fallback for any other size, read at run time
+class RuntimeDims
 {
 public:
 	int width;
 	int height;
-	int my_matter;
-	int opp_matter;
-	vector<Case> cases;
-	vector<Bot> my_bots;
-	vector<Bot> opp_bots;
-	vector<Teritory> teritories;
-	ActionManager action_manager;
-	Game(int width, int height);
-	void read_inputs();
-	void register_action(AAction *action);
-	void register_spawn_remove_move(ActionSpawn *action);
-	void execute_actions();
-	Case &get_case(Position pos);
-	Case &get_case(int x, int y);
-	vector<Teritory> get_teritories();
-	Bot &getBot(Position pos);
+	int size;
+	RuntimeDims(int width, int height)
+	{
+		this->width = width;
+		this->height = height;
+		this->size = width * height;
+	}
 };
 
 /*=======================================================================
-||                         Territory prototype                         ||
+||                               Zobrist                               ||
 =======================================================================*/
-class Teritory
-{
-public:
-	vector<Case> cases;
-	vector<Bot> my_bots;
-	vector<Bot> opp_bots;
-	Mode mode;
-	Player owner;
-	Teritory();
-	Teritory(const Teritory &t);
-	void operator=(const Teritory &t);
-	void add_case(Case c);
-	bool is_in(Position pos);
-	bool is_in(Case c);
-	void addCaseAndNeighbours(Game &game, Case &c);
-	void addCaseAndNeighbours(Game &game, Case &c, int xDir, int yDir);
-	void buildFrom(Game &game, Case &c);
-	void buildFrom(Game &game, Case &c, int xDir, int yDir);
-	bool isIsolate();
-	bool isIsolateWithCase();
-	vector<Bot> getBots(Game &game);
-};
+#define ZOBRIST_SIZE 0
+#define ZOBRIST_SCRAP 1
+#define ZOBRIST_OWNER 2
+#define ZOBRIST_UNITS 3
+#define ZOBRIST_RECYCLER 4
+
+// Key of one value of one cell field (splitmix64 of the triple). Derived
+// instead of tabled so that any unit count gets its own key.
+inline uint64_t zobrist(int field, int cell, int value)
+{
+	uint64_t x = ((uint64_t)(field * MAX_CASES + cell) << 32 | (uint32_t)value) + 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
 
 /*=======================================================================
-||                      ActionManager declaration                      ||
+||                                Grid                                 ||
 =======================================================================*/
-ActionManager::ActionManager() {}
-void ActionManager::addAction(Game *game, AAction *action)
+#define CASE_RECYCLER 1
+#define CASE_CAN_BUILD 2
+#define CASE_CAN_SPAWN 4
+#define CASE_IN_RANGE 8
+
+// Board storage with one packed array per field, indexed like
+// Game::get_case (y * width + x). Case is only a snapshot built on demand.
+class Grid
 {
-	if (dynamic_cast<ActionSpawn *>(action) != NULL)
+public:
+	int width;
+	int height;
+	int size;
+	int8_t scrap[MAX_CASES];
+	int8_t owner[MAX_CASES];
+	int16_t units[MAX_CASES];
+	uint8_t flags[MAX_CASES];
+	// Zobrist hash of scrap, owner, units and the recycler bit. The set_*
+	// methods keep it up to date; rehash() after writing the arrays directly.
+	uint64_t hash;
+	Grid(int width, int height)
 	{
-		if (dynamic_cast<ActionSpawn *>(action)->amount_of_units <= 0)
-			return;
+		this->width = width;
+		this->height = height;
+		this->size = width * height;
+		clear();
 	}
-	game->my_matter -= action->matterRemove();
-	actions.push_back(action);
-}
-
-void ActionManager::execute()
-{
-	if (actions.size() > 0)
+	void clear()
+	{
+		fill(scrap, scrap + MAX_CASES, 0);
+		fill(owner, owner + MAX_CASES, PLAYER_NONE);
+		fill(units, units + MAX_CASES, 0);
+		fill(flags, flags + MAX_CASES, 0);
+		rehash();
+	}
+	void rehash()
 	{
-		for (auto it = actions.begin(); it != actions.end(); it++)
+		hash = zobrist(ZOBRIST_SIZE, 0, width);
+		for (int i = 0; i < size; i++)
 		{
-			cout << (it == actions.begin() ? "" : ";") << (*it)->extractString();
-			delete *it;
+			hash ^= zobrist(ZOBRIST_SCRAP, i, scrap[i]) ^ zobrist(ZOBRIST_OWNER, i, owner[i]) ^ zobrist(ZOBRIST_UNITS, i, units[i]);
+			if (flags[i] & CASE_RECYCLER)
+				hash ^= zobrist(ZOBRIST_RECYCLER, i, 1);
 		}
-		cout << endl;
 	}
-	else
+	void set_scrap(int index, int value)
 	{
-		cout << "WAIT" << endl;
+		if (scrap[index] == value)
+			return;
+		hash ^= zobrist(ZOBRIST_SCRAP, index, scrap[index]) ^ zobrist(ZOBRIST_SCRAP, index, value);
+		scrap[index] = value;
 	}
-	actions.clear();
-}
-
-/*=======================================================================
-||                          Game declaration                           ||
-=======================================================================*/
-Game::Game(int width, int height)
-{
-	this->width = width;
-	this->height = height;
-}
-
-void Game::read_inputs()
-{
-	cases.clear();
-	my_bots.clear();
-	opp_bots.clear();
-	teritories.clear();
-
-	cin >> my_matter >> opp_matter;
-	cin.ignore();
-	for (int i = 0; i < height; i++)
-	{
-		for (int j = 0; j < width; j++)
-		{
-			int scrap_amount;
-			int owner;
-			int units;
-			int recycler;
-			int can_build;
-			int can_spawn;
-			int in_range_of_recycler;
-			cin >> scrap_amount >> owner >> units >> recycler >> can_build >> can_spawn >> in_range_of_recycler;
-			cin.ignore();
-			Case c = Case(Position(j, i), scrap_amount, convertToPlayer(owner), units, recycler, can_build, can_spawn, in_range_of_recycler);
-			if (INPUT_DEBUG)
-			{
-				cerr << "Read case " << c.pos.x << " " << c.pos.y << endl;
-			}
-			cases.push_back(c);
-			for (int i = 0; i < units; i++)
-			{
-				if (owner == PLAYER_ME)
-				{
-					my_bots.push_back(Bot(c.pos, convertToPlayer(owner)));
-				}
-				else if (owner == PLAYER_OPPONENT)
-				{
-					opp_bots.push_back(Bot(c.pos, convertToPlayer(owner)));
-				}
-			}
-		}
+	void set_owner(int index, int value)
+	{
+		if (owner[index] == value)
+			return;
+		hash ^= zobrist(ZOBRIST_OWNER, index, owner[index]) ^ zobrist(ZOBRIST_OWNER, index, value);
+		owner[index] = value;
 	}
-	if (INPUT_DEBUG)
+	void set_units(int index, int value)
 	{
-		cerr << cases.size() << " cases readed" << endl;
-		cerr << "All inputs readed" << endl;
+		if (units[index] == value)
+			return;
+		hash ^= zobrist(ZOBRIST_UNITS, index, units[index]) ^ zobrist(ZOBRIST_UNITS, index, value);
+		units[index] = value;
 	}
-}
-
-void Game::register_action(AAction *action)
-{
-	if (dynamic_cast<ActionBuildRecycler *>(action) != NULL)
+	void set_recycler(int index, bool recycler)
 	{
-		ActionBuildRecycler *build = dynamic_cast<ActionBuildRecycler *>(action);
-		if (build->pos.x < 0 || build->pos.x >= width || build->pos.y < 0 || build->pos.y >= height)
+		if (((flags[index] & CASE_RECYCLER) != 0) == recycler)
 			return;
-		for (auto it = cases.begin(); it != cases.end(); it++)
+		hash ^= zobrist(ZOBRIST_RECYCLER, index, 1);
+		flags[index] ^= CASE_RECYCLER;
+	}
+	int index(Position pos)
+	{
+		return pos.y * width + pos.x;
+	}
+	Position position(int index)
+	{
+		return Position(index % width, index / width);
+	}
+	bool is_in(Position pos)
+	{
+		return pos.x >= 0 && pos.x < width && pos.y >= 0 && pos.y < height;
+	}
+	bool is_walkable(int index)
+	{
+		return scrap[index] > 0 && !(flags[index] & CASE_RECYCLER);
+	}
+	bool is_walkable(Position pos)
+	{
+		return is_in(pos) && is_walkable(index(pos));
+	}
+	CellSet walkable()
+	{
+		CellSet result;
+		for (int i = 0; i < size; i++)
 		{
-			if (it->pos == build->pos)
-			{
-				it->recycler = 1;
-				it->can_build = 0;
-				it->can_spawn = 0;
-				it->in_range_of_recycler = 1;
-				break;
-			}
+			if (is_walkable(i))
+				result.set(i);
 		}
+		return result;
 	}
-	action_manager.addAction(this, action);
-}
-
-void Game::execute_actions()
-{
-	action_manager.execute();
-}
-
-Case &Game::get_case(Position pos)
-{
-	return cases[pos.y * width + pos.x];
-}
-
-Case &Game::get_case(int x, int y)
-{
-	return get_case(Position(x, y));
-}
-
-void Game::register_spawn_remove_move(ActionSpawn *action)
-{
-	for (auto it = action_manager.actions.begin(); it != action_manager.actions.end(); it++)
+	CellSet owned_by(Player player)
 	{
-		if (dynamic_cast<ActionMove *>(*it) != NULL)
+		CellSet result;
+		for (int i = 0; i < size; i++)
 		{
-			ActionMove *move = dynamic_cast<ActionMove *>(*it);
-			if (move->from == action->pos)
-			{
-				if (SPAWN_DEBUG)
-					cerr << "Remove move action at " << move->from.x << " " << move->from.y << endl;
-				action_manager.actions.erase(it);
-				break;
-			}
+			if (owner[i] == player)
+				result.set(i);
 		}
+		return result;
 	}
-	action_manager.addAction(this, action);
-}
-
-vector<Teritory> Game::get_teritories()
-{
-	if (teritories.size() == 0)
+	// First cell on a shortest walkable path from `from` toward `to`.
+	// If `to` can't be reached, aim for the reachable cell closest to it.
+	Position next_step(Position from, Position to)
+	{
+		return next_step(from, to, RuntimeDims(width, height));
+	}
+	template <class Dims>
+	Position next_step(Position from, Position to, Dims dims)
 	{
-		for (auto it = cases.begin(); it != cases.end(); it++)
+		static const int dx[4] = {0, 1, 0, -1};
+		static const int dy[4] = {-1, 0, 1, 0};
+		int parent[MAX_CASES];
+		int queue[MAX_CASES];
+		int queue_size = 0;
+		fill(parent, parent + dims.size, -1);
+		int start = from.y * dims.width + from.x;
+		int best = start;
+		int best_distance = from.distance(to);
+		parent[start] = start;
+		queue[queue_size++] = start;
+		for (int i = 0; i < queue_size; i++)
 		{
-			if (it->scrap_amount > 0 && it->recycler <= 0)
+			Position current = Position(queue[i] % dims.width, queue[i] / dims.width);
+			int distance = current.distance(to);
+			if (distance < best_distance)
 			{
-				bool found = false;
-				for (auto it2 = teritories.begin(); it2 != teritories.end(); it2++)
-				{
-					if (it2->is_in(*it))
-					{
-						found = true;
-						break;
-					}
-				}
-				if (found)
-					continue;
-				Teritory t = Teritory();
-				t.buildFrom(*this, *it);
-				teritories.push_back(t);
+				best = queue[i];
+				best_distance = distance;
+				if (distance == 0)
+					break;
 			}
-		}
-		if (TERRITORY_DEBUG)
-		{
-			for (auto it = teritories.begin(); it != teritories.end(); it++)
+			for (int d = 0; d < 4; d++)
 			{
-				cerr << "Territory at " << it->cases[0].pos.x << " " << it->cases[0].pos.y << " with " << it->cases.size() << " cases" << endl;
+				Position next = Position(current.x + dx[d], current.y + dy[d]);
+				if (next.x < 0 || next.x >= dims.width || next.y < 0 || next.y >= dims.height)
+					continue;
+				int cell = next.y * dims.width + next.x;
+				if (parent[cell] != -1 || !is_walkable(cell))
+					continue;
+				parent[cell] = queue[i];
+				queue[queue_size++] = cell;
 			}
 		}
+		while (parent[best] != start)
+			best = parent[best];
+		return Position(best % dims.width, best / dims.width);
 	}
-	return teritories;
-}
-
-Bot &Game::getBot(Position pos)
-{
-	for (auto it = my_bots.begin(); it != my_bots.end(); it++)
+	// Recompute the flags the referee sends, always from my point of view
+	void refresh_flags()
 	{
-		if (it->pos == pos)
-		{
-			return *it;
-		}
+		refresh_flags(RuntimeDims(width, height));
 	}
-	for (auto it = opp_bots.begin(); it != opp_bots.end(); it++)
+	template <class Dims>
+	void refresh_flags(Dims dims)
 	{
-		if (it->pos == pos)
+		for (int i = 0; i < dims.size; i++)
+			flags[i] &= CASE_RECYCLER;
+		for (int i = 0; i < dims.size; i++)
+		{
+			if (!(flags[i] & CASE_RECYCLER))
+				continue;
+			int x = i % dims.width;
+			flags[i] |= CASE_IN_RANGE;
+			if (x > 0)
+				flags[i - 1] |= CASE_IN_RANGE;
+			if (x < dims.width - 1)
+				flags[i + 1] |= CASE_IN_RANGE;
+			if (i >= dims.width)
+				flags[i - dims.width] |= CASE_IN_RANGE;
+			if (i + dims.width < dims.size)
+				flags[i + dims.width] |= CASE_IN_RANGE;
+		}
+		for (int i = 0; i < dims.size; i++)
 		{
-			return *it;
+			if (owner[i] == PLAYER_ME && is_walkable(i))
+			{
+				flags[i] |= CASE_CAN_SPAWN;
+				if (units[i] == 0)
+					flags[i] |= CASE_CAN_BUILD;
+			}
 		}
 	}
-	return my_bots[0];
-}
+	Case get(int index)
+	{
+		uint8_t f = flags[index];
+		return Case(position(index), scrap[index], (Player)owner[index], units[index], (f & CASE_RECYCLER) != 0, (f & CASE_CAN_BUILD) != 0, (f & CASE_CAN_SPAWN) != 0, (f & CASE_IN_RANGE) != 0);
+	}
+};
 
 /*=======================================================================
-||                         Territory declaration                       ||
+||                             BoardPlanes                             ||
 =======================================================================*/
-
-Teritory::Teritory() : mode(EXPAND) {}
-
-Teritory::Teritory(const Teritory &t) { *this = t; }
-
-void Teritory::operator=(const Teritory &t)
+// Bit planes of the board, so neighbourhood questions are answered for
+// every cell at once with shifts instead of per-cell get_case calls
+class BoardPlanes
 {
-	cases = t.cases;
-	my_bots = t.my_bots;
-	opp_bots = t.opp_bots;
-}
+public:
+	int width;
+	CellSet board;
+	CellSet has_left;
+	CellSet has_right;
+	CellSet interior;
+	CellSet scrap;
+	CellSet walkable;
+	CellSet mine;
+	CellSet opponent;
+	CellSet recycler;
+	CellSet in_range;
+	CellSet units;
+	CellSet my_units;
+	CellSet opp_units;
+	void build(Grid &grid)
+	{
+		width = grid.width;
+		board.clear();
+		has_left.clear();
+		has_right.clear();
+		scrap.clear();
+		walkable.clear();
+		mine.clear();
+		opponent.clear();
+		recycler.clear();
+		in_range.clear();
+		my_units.clear();
+		opp_units.clear();
+		for (int i = 0; i < grid.size; i++)
+		{
+			int x = i % grid.width;
+			board.set(i);
+			if (x > 0)
+				has_left.set(i);
+			if (x < grid.width - 1)
+				has_right.set(i);
+			if (grid.scrap[i] > 0)
+				scrap.set(i);
+			if (grid.is_walkable(i))
+				walkable.set(i);
+			if (grid.owner[i] == PLAYER_ME)
+				mine.set(i);
+			else if (grid.owner[i] == PLAYER_OPPONENT)
+				opponent.set(i);
+			if (grid.flags[i] & CASE_RECYCLER)
+				recycler.set(i);
+			if (grid.flags[i] & CASE_IN_RANGE)
+				in_range.set(i);
+			if (grid.units[i] > 0 && grid.owner[i] == PLAYER_ME)
+				my_units.set(i);
+			else if (grid.units[i] > 0 && grid.owner[i] == PLAYER_OPPONENT)
+				opp_units.set(i);
+		}
+		units = my_units | opp_units;
+		interior = board & has_left & has_right & board.shifted(width) & board.shifted(-width);
+	}
+	// Cell (x, y) is in the result when (x - dx, y - dy) is in `cells`
+	CellSet translate(const CellSet &cells, int dx, int dy) const
+	{
+		CellSet result = cells;
+		if (dx > 0)
+			result = (result & has_right).shifted(1);
+		else if (dx < 0)
+			result = (result & has_left).shifted(-1);
+		if (dy != 0)
+			result = result.shifted(dy * width);
+		return result & board;
+	}
+	// Cells with at least one of their 4 neighbours in `cells`
+	CellSet neighbours(const CellSet &cells) const
+	{
+		return translate(cells, 1, 0) | translate(cells, -1, 0) | translate(cells, 0, 1) | translate(cells, 0, -1);
+	}
+	CellSet dilate(const CellSet &cells) const
+	{
+		return cells | neighbours(cells);
+	}
+	// Cells whose 4 neighbours are all inside the map and in `cells`
+	CellSet erode(const CellSet &cells) const
+	{
+		return interior - neighbours(board - cells);
+	}
+	// Owned empty cells where a recycler can still be built
+	CellSet defendable() const
+	{
+		return mine & (scrap - recycler - units);
+	}
+	// Cells whose recycler would harvest 4 fresh neighbours without
+	// sitting inside my own territory
+	CellSet useful_for_recycler() const
+	{
+		return erode(scrap) - neighbours(in_range) - erode(mine);
+	}
+};
 
-void Teritory::add_case(Case c)
+/*=======================================================================
+||                            DistanceField                            ||
+=======================================================================*/
+// Walking distance from every cell to the closest of a set of sources,
+// through walkable cells only, and which source that is
+class DistanceField
 {
-	cases.push_back(c);
-	if (c.units > 0)
+public:
+	int16_t distance[MAX_CASES];
+	int16_t nearest[MAX_CASES];
+	void compute(Grid &grid, CellSet &sources)
+	{
+		compute(grid, sources, RuntimeDims(grid.width, grid.height));
+	}
+	template <class Dims>
+	void compute(Grid &grid, CellSet &sources, Dims dims)
 	{
-		for (int i = 0; i < c.units; i++)
+		int queue[MAX_CASES];
+		int queue_size = 0;
+		fill(distance, distance + dims.size, -1);
+		fill(nearest, nearest + dims.size, -1);
+		for (int i = sources.first(); i != -1; i = sources.next(i))
 		{
-			if (c.owner == PLAYER_ME)
+			distance[i] = 0;
+			nearest[i] = i;
+			queue[queue_size++] = i;
+		}
+		for (int q = 0; q < queue_size; q++)
+		{
+			int current = queue[q];
+			int around[4];
+			int count = neighbours(dims, current, around);
+			for (int n = 0; n < count; n++)
 			{
-				my_bots.push_back(Bot(c.pos, PLAYER_ME));
+				int next = around[n];
+				if (distance[next] != -1 || !grid.is_walkable(next))
+					continue;
+				distance[next] = distance[current] + 1;
+				nearest[next] = nearest[current];
+				queue[queue_size++] = next;
 			}
-			else if (c.owner == PLAYER_OPPONENT)
+		}
+	}
+	// Top, left, right, bottom neighbours inside the map
+	static int neighbours(Grid &grid, int index, int around[4])
+	{
+		return neighbours(RuntimeDims(grid.width, grid.height), index, around);
+	}
+	template <class Dims>
+	static int neighbours(Dims dims, int index, int around[4])
+	{
+		int x = index % dims.width;
+		int count = 0;
+		if (index >= dims.width)
+			around[count++] = index - dims.width;
+		if (x > 0)
+			around[count++] = index - 1;
+		if (x < dims.width - 1)
+			around[count++] = index + 1;
+		if (index + dims.width < dims.size)
+			around[count++] = index + dims.width;
+		return count;
+	}
+	// Closest cell of `targets` walking from `from`, or -1
+	static int nearest_in(Grid &grid, int from, CellSet &targets)
+	{
+		if (targets.test(from))
+			return from;
+		int queue[MAX_CASES];
+		int queue_size = 0;
+		CellSet seen;
+		seen.set(from);
+		queue[queue_size++] = from;
+		for (int q = 0; q < queue_size; q++)
+		{
+			int around[4];
+			int count = neighbours(grid, queue[q], around);
+			for (int n = 0; n < count; n++)
 			{
-				opp_bots.push_back(Bot(c.pos, PLAYER_OPPONENT));
+				int next = around[n];
+				if (seen.test(next) || !grid.is_walkable(next))
+					continue;
+				if (targets.test(next))
+					return next;
+				seen.set(next);
+				queue[queue_size++] = next;
 			}
 		}
+		return -1;
 	}
-}
+};
 
-bool Teritory::is_in(Position pos)
+/*=======================================================================
+||                             Assignment                              ||
+=======================================================================*/
+#define ASSIGNMENT_UNREACHABLE 1000
+
+// Matches units to distinct target cells with the minimum summed walking
+// distance (Hungarian algorithm). Distances from each source cell are kept
+// between turns and only dropped when the set of walkable cells changes.
+class AssignmentSolver
 {
-	for (auto it = cases.begin(); it != cases.end(); it++)
+public:
+	int16_t *distances_from(Grid &grid, int source)
 	{
-		if (it->pos == pos)
+		if (distances.empty())
+			distances.resize(MAX_CASES * MAX_CASES);
+		CellSet current = grid.walkable();
+		if (!(current == walkable))
+		{
+			walkable = current;
+			computed.clear();
+		}
+		int16_t *row = &distances[source * MAX_CASES];
+		if (!computed.test(source))
 		{
-			return true;
+			CellSet sources;
+			sources.set(source);
+			field.compute(grid, sources);
+			copy(field.distance, field.distance + grid.size, row);
+			computed.set(source);
 		}
+		return row;
 	}
-	return false;
-}
-
-bool Teritory::is_in(Case c)
-{
-	return is_in(c.pos);
-}
-
-void Teritory::addCaseAndNeighbours(Game &game, Case &c)
-{
-	add_case(c);
-	for (auto it = game.cases.begin(); it != game.cases.end(); it++)
+	// result[i] is the index in `targets` given to units[i], or -1
+	void solve(Grid &grid, const vector<int> &units, const vector<int> &targets, vector<int> &result)
 	{
-		if (it->pos.distance(c.pos) == 1 && it->scrap_amount > 0 && it->recycler <= 0 && !is_in(*it))
-		{
-			addCaseAndNeighbours(game, *it);
+		result.assign(units.size(), -1);
+		if (units.empty() || targets.empty())
+			return;
+		bool transposed = units.size() > targets.size();
+		int rows = transposed ? targets.size() : units.size();
+		int cols = transposed ? units.size() : targets.size();
+		cost.resize(rows * cols);
+		for (size_t i = 0; i < units.size(); i++)
+		{
+			int16_t *row = distances_from(grid, units[i]);
+			for (size_t j = 0; j < targets.size(); j++)
+			{
+				int distance = row[targets[j]];
+				if (distance < 0)
+					distance = ASSIGNMENT_UNREACHABLE;
+				if (transposed)
+					cost[j * cols + i] = distance;
+				else
+					cost[i * cols + j] = distance;
+			}
+		}
+		hungarian(rows, cols);
+		for (int j = 1; j <= cols; j++)
+		{
+			if (match[j] == 0)
+				continue;
+			int row = match[j] - 1;
+			int col = j - 1;
+			if (cost[row * cols + col] >= ASSIGNMENT_UNREACHABLE)
+				continue;
+			if (transposed)
+				result[col] = row;
+			else
+				result[row] = col;
+		}
+	}
+
+private:
+	vector<int16_t> distances;
+	CellSet computed;
+	CellSet walkable;
+	DistanceField field;
+	vector<int> cost;
+	vector<int> row_potential;
+	vector<int> col_potential;
+	vector<int> match;
+	vector<int> way;
+	vector<int> min_slack;
+	vector<char> used;
+
+	// Potentials-based O(rows^2 * cols) version, rows <= cols, 1-indexed
+	void hungarian(int rows, int cols)
+	{
+		row_potential.assign(rows + 1, 0);
+		col_potential.assign(cols + 1, 0);
+		match.assign(cols + 1, 0);
+		way.assign(cols + 1, 0);
+		for (int i = 1; i <= rows; i++)
+		{
+			match[0] = i;
+			int col = 0;
+			min_slack.assign(cols + 1, INT32_MAX);
+			used.assign(cols + 1, false);
+			do
+			{
+				used[col] = true;
+				int row = match[col];
+				int delta = INT32_MAX;
+				int next = 0;
+				for (int j = 1; j <= cols; j++)
+				{
+					if (used[j])
+						continue;
+					int slack = cost[(row - 1) * cols + j - 1] - row_potential[row] - col_potential[j];
+					if (slack < min_slack[j])
+					{
+						min_slack[j] = slack;
+						way[j] = col;
+					}
+					if (min_slack[j] < delta)
+					{
+						delta = min_slack[j];
+						next = j;
+					}
+				}
+				for (int j = 0; j <= cols; j++)
+				{
+					if (used[j])
+					{
+						row_potential[match[j]] += delta;
+						col_potential[j] -= delta;
+					}
+					else
+						min_slack[j] -= delta;
+				}
+				col = next;
+			} while (match[col] != 0);
+			do
+			{
+				int previous = way[col];
+				match[col] = match[previous];
+				col = previous;
+			} while (col != 0);
 		}
 	}
-}
+};
 
-void Teritory::addCaseAndNeighbours(Game &game, Case &c, int xDir, int yDir)
+/*=======================================================================
+||                             RecyclerMap                             ||
+=======================================================================*/
+// What a recycler would do on every cell, computed in one sweep. A
+// recycler on a cell with s scrap lives s turns and harvests each cell in
+// range until it runs out.
+class RecyclerMap
 {
-	add_case(c);
-	for (auto it = game.cases.begin(); it != game.cases.end(); it++)
-	{
-		if (it->pos.distance(c.pos) == 1 && it->scrap_amount > 0 && it->recycler <= 0 && !is_in(*it))
-		{
-			if ((xDir == 1 && it->pos.x >= c.pos.x) || (xDir == -1 && it->pos.x <= c.pos.x) || (xDir == 0))
-				if ((yDir == 1 && it->pos.y >= c.pos.y) || (yDir == -1 && it->pos.y <= c.pos.y) || (yDir == 0))
-					addCaseAndNeighbours(game, *it);
+public:
+	int16_t yield[MAX_CASES];	   // scrap harvested over its lifetime
+	int8_t grass[MAX_CASES];	   // cells in range turned to grass, itself included
+	int8_t first_grass[MAX_CASES]; // turn the first neighbour turns to grass, 0 if none
+	int8_t overlap[MAX_CASES];	   // neighbours already in range of a recycler
+	int8_t spared[MAX_CASES];	   // neighbours already grass or outliving it
+	void compute(Grid &grid)
+	{
+		for (int i = 0; i < grid.size; i++)
+		{
+			int scrap = grid.scrap[i];
+			yield[i] = scrap;
+			grass[i] = scrap > 0;
+			first_grass[i] = 0;
+			overlap[i] = 0;
+			spared[i] = 0;
+			int around[4];
+			int count = DistanceField::neighbours(grid, i, around);
+			for (int n = 0; n < count; n++)
+			{
+				int other = grid.scrap[around[n]];
+				if (grid.flags[around[n]] & CASE_IN_RANGE)
+					overlap[i]++;
+				if (other == 0 || other > scrap)
+					spared[i]++;
+				if (other == 0)
+					continue;
+				yield[i] += min(other, scrap);
+				if (other <= scrap)
+				{
+					grass[i]++;
+					if (first_grass[i] == 0 || other < first_grass[i])
+						first_grass[i] = other;
+				}
+			}
 		}
 	}
-}
+};
 
-void Teritory::buildFrom(Game &game, Case &c)
+/*=======================================================================
+||                             ThreatModel                             ||
+=======================================================================*/
+#define THREAT_HORIZON 3
+#define THREAT_SPAWN 0.15f
+#define THREAT_SPAWN_TURNS 2
+// Spawn on threatened cells before the rest of the turn (anticipate_threats).
+// Off until a regress or self-play run shows it pays for the matter; the
+// model is only fed while it is on.
+#ifndef THREAT_SPAWNS
+#define THREAT_SPAWNS 0
+#endif
+
+// Where opponent units are likely to stand in the next turns. The drift of
+// their centre of mass between observed turns gives a heading; units are
+// then spread over walkable neighbours, favouring that heading and cells
+// the opponent doesn't own yet, and expected counts become probabilities.
+class ThreatModel
 {
-	if (TERRITORY_DEBUG)
-		cerr << "Building territory from " << c.pos.x << " " << c.pos.y << endl;
-	addCaseAndNeighbours(game, c);
-	if (isIsolate())
+public:
+	float threat[THREAT_HORIZON + 1][MAX_CASES]; // [turns ahead][cell]
+	float drift_x;
+	float drift_y;
+	ThreatModel()
 	{
-		mode = SPLATOON;
+		drift_x = 0;
+		drift_y = 0;
+		has_previous = false;
 	}
-}
-
-void Teritory::buildFrom(Game &game, Case &c, int xDir, int yDir)
-{
-	if (TERRITORY_DEBUG)
-		cerr << "Building territory from " << c.pos.x << " " << c.pos.y << endl;
-	addCaseAndNeighbours(game, c, xDir, yDir);
-	if (isIsolate())
+	// Chance that an opponent unit reaches `cell` within `turns` turns
+	float within(int cell, int turns)
 	{
-		mode = SPLATOON;
+		float result = 0;
+		for (int t = 1; t <= turns && t <= THREAT_HORIZON; t++)
+			result = max(result, threat[t][cell]);
+		return result;
 	}
-}
-
-bool Teritory::isIsolate()
-{
-	bool isolate = true;
-	owner = PLAYER_NONE;
-	for (auto it = cases.begin(); it != cases.end(); it++)
+	void observe(Grid &grid)
 	{
-		if (owner == PLAYER_NONE)
+		float x;
+		float y;
+		if (centre(grid, x, y))
 		{
-			owner = it->owner;
+			if (has_previous)
+			{
+				drift_x = (drift_x + max(-1.0f, min(1.0f, x - previous_x))) / 2;
+				drift_y = (drift_y + max(-1.0f, min(1.0f, y - previous_y))) / 2;
+			}
+			previous_x = x;
+			previous_y = y;
+			has_previous = true;
 		}
-		else if (owner != it->owner && it->owner != PLAYER_NONE)
+		float mass[2][MAX_CASES];
+		for (int i = 0; i < grid.size; i++)
 		{
-			isolate = false;
+			mass[0][i] = grid.owner[i] == PLAYER_OPPONENT ? grid.units[i] : 0;
+			threat[0][i] = mass[0][i] > 0;
+		}
+		for (int t = 1; t <= THREAT_HORIZON; t++)
+		{
+			float *from = mass[(t - 1) & 1];
+			float *to = mass[t & 1];
+			fill(to, to + grid.size, 0.0f);
+			for (int i = 0; i < grid.size; i++)
+			{
+				if (from[i] == 0)
+					continue;
+				spread(grid, i, from[i], to);
+			}
+			for (int i = 0; i < grid.size; i++)
+				threat[t][i] = 1 - exp(-to[i]);
 		}
 	}
-	return isolate;
-}
 
-bool Teritory::isIsolateWithCase()
-{
-	bool isolate = true;
-	owner = PLAYER_NONE;
-	for (auto it = cases.begin(); it != cases.end(); it++)
+private:
+	bool has_previous;
+	float previous_x;
+	float previous_y;
+	bool centre(Grid &grid, float &x, float &y)
 	{
-		if (owner == PLAYER_NONE && it->units > 0)
-		{
-			owner = it->owner;
-		}
-		else if (owner != it->owner && it->owner != PLAYER_NONE && it->units > 0)
+		int total = 0;
+		x = 0;
+		y = 0;
+		for (int i = 0; i < grid.size; i++)
 		{
-			isolate = false;
+			if (grid.owner[i] != PLAYER_OPPONENT || grid.units[i] == 0)
+				continue;
+			total += grid.units[i];
+			x += (i % grid.width) * grid.units[i];
+			y += (i / grid.width) * grid.units[i];
 		}
+		if (total == 0)
+			return false;
+		x /= total;
+		y /= total;
+		return true;
 	}
-	return isolate;
-}
-
-vector<Bot> Teritory::getBots(Game &game)
-{
-	vector<Bot> bots;
-	for (auto it = cases.begin(); it != cases.end(); it++)
+	void spread(Grid &grid, int cell, float amount, float *to)
 	{
-		if (it->units > 0)
+		int around[4];
+		int count = DistanceField::neighbours(grid, cell, around);
+		float weights[4];
+		float total = 0.5f;
+		for (int n = 0; n < count; n++)
 		{
-			bots.push_back(game.getBot(it->pos));
+			weights[n] = 0;
+			if (!grid.is_walkable(around[n]))
+				continue;
+			int dx = around[n] % grid.width - cell % grid.width;
+			int dy = around[n] / grid.width - cell / grid.width;
+			weights[n] = 1 + 2 * max(0.0f, dx * drift_x + dy * drift_y) + (grid.owner[around[n]] != PLAYER_OPPONENT);
+			total += weights[n];
 		}
+		to[cell] += amount * 0.5f / total;
+		for (int n = 0; n < count; n++)
+			to[around[n]] += amount * weights[n] / total;
 	}
-	return bots;
-}
+};
 
 /*=======================================================================
-||                                                                     ||
-||                          Utils functions                            ||
-||                                                                     ||
+||                                 Bot                                 ||w
 =======================================================================*/
-
-Position get_nearest(Position from, vector<Bot> targets)
+// The stack of units one player has on a cell
+class Bot
 {
-	if (targets.size() == 0)
+public:
+	Position pos;
+	Position from;
+	Player owner;
+	int units;
+	Bot(Position pos, Player owner, int units = 1)
 	{
-		return from;
+		this->pos = pos;
+		this->from = pos;
+		this->owner = owner;
+		this->units = units;
+		if (tracing(TRACE_BOT))
+			trace(TRACE_BOT, "bot created", pos.x, pos.y, units);
 	}
-	Position nearest = targets.front().pos;
-	int nearest_distance = from.distance(nearest);
-	for (auto it = targets.begin(); it != targets.end(); it++)
+	Bot(const Bot &other)
 	{
-		int distance = from.distance(it->pos);
-		if (distance < nearest_distance)
-		{
-			nearest = it->pos;
-			nearest_distance = distance;
-		}
+		*this = other;
 	}
-	return nearest;
-}
-
-Position get_nearest(Position from, vector<Case> targets)
-{
-	if (targets.size() == 0)
+	Bot &operator=(const Bot &other)
 	{
-		return from;
+		pos = other.pos;
+		from = other.from;
+		owner = other.owner;
+		units = other.units;
+		return *this;
 	}
-	Position nearest = targets.front().pos;
-	int nearest_distance = from.distance(nearest);
-	while (targets.size() > 0)
+	int distance(Bot &other)
 	{
-		Case c = targets[rand() % targets.size()];
-		int distance = from.distance(c.pos);
-		if (distance < nearest_distance)
-		{
-			nearest = c.pos;
-			nearest_distance = distance;
-		}
-		targets.erase(find(targets.begin(), targets.end(), c));
+		return pos.distance(other.pos);
 	}
-	return nearest;
-}
+};
 
-bool isCaseUsefulForRecycler(Game &game, Position pos)
+// Per-row summary of a list of bots for the line heuristics: units and
+// leftmost/rightmost stack of each row, and prefix counts over the rows.
+// first/last keep the earliest bot of the list on ties, like the scans did.
+class RowIndex
 {
-	if (RECYCLER_DEBUG)
-		cerr << "Test case " << pos.x << " " << pos.y << " for recycler: ";
-	if (pos.x < 1 || pos.x > game.width - 2 || pos.y < 1 || pos.y > game.height - 2)
+public:
+	int units[MAX_HEIGHT];
+	int16_t first[MAX_HEIGHT];
+	int16_t last[MAX_HEIGHT];
+	// Over rows [0, row): units, and rows holding at least one unit
+	int units_before[MAX_HEIGHT + 1];
+	int rows_before[MAX_HEIGHT + 1];
+	RowIndex()
 	{
-		if (RECYCLER_DEBUG)
-			cerr << "out of map" << endl;
-		return false;
+		clear();
 	}
-	if (game.get_case(pos.x, pos.y - 1).scrap_amount <= 0)
+	void clear()
 	{
-		if (RECYCLER_DEBUG)
-			cerr << "no scrap on top" << endl;
-		return false;
+		fill(units, units + MAX_HEIGHT, 0);
+		fill(first, first + MAX_HEIGHT, -1);
+		fill(last, last + MAX_HEIGHT, -1);
+		fill(units_before, units_before + MAX_HEIGHT + 1, 0);
+		fill(rows_before, rows_before + MAX_HEIGHT + 1, 0);
 	}
-	if (game.get_case(pos.x, pos.y + 1).scrap_amount <= 0)
+	// Count entry `index` of `bots`
+	void add(vector<Bot> &bots, int index)
 	{
-		if (RECYCLER_DEBUG)
-			cerr << "no scrap on bottom" << endl;
-		return false;
+		Bot &bot = bots[index];
+		int row = bot.pos.y;
+		assert(row >= 0 && row < MAX_HEIGHT);
+		extremes(bots, index);
+		bool new_row = units[row] == 0;
+		units[row] += bot.units;
+		for (int r = row + 1; r <= MAX_HEIGHT; r++)
+		{
+			units_before[r] += bot.units;
+			rows_before[r] += new_row;
+		}
 	}
-	if (game.get_case(pos.x - 1, pos.y).scrap_amount <= 0)
+	// Take back what add() counted for entry `index`, before it changes
+	void remove(vector<Bot> &bots, int index)
 	{
-		if (RECYCLER_DEBUG)
-			cerr << "no scrap on left" << endl;
-		return false;
+		Bot &bot = bots[index];
+		int row = bot.pos.y;
+		assert(row >= 0 && row < MAX_HEIGHT);
+		units[row] -= bot.units;
+		bool emptied = units[row] == 0;
+		for (int r = row + 1; r <= MAX_HEIGHT; r++)
+		{
+			units_before[r] -= bot.units;
+			rows_before[r] -= emptied;
+		}
+		if (first[row] != index && last[row] != index)
+			return;
+		first[row] = -1;
+		last[row] = -1;
+		for (size_t i = 0; i < bots.size(); i++)
+		{
+			if ((int)i != index && bots[i].pos.y == row)
+				extremes(bots, i);
+		}
 	}
-	if (game.get_case(pos.x + 1, pos.y).scrap_amount <= 0)
+	void build(vector<Bot> &bots)
 	{
-		if (RECYCLER_DEBUG)
-			cerr << "no scrap on right" << endl;
-		return false;
+		clear();
+		for (size_t i = 0; i < bots.size(); i++)
+			add(bots, i);
 	}
-	if (game.get_case(pos.x, pos.y - 1).in_range_of_recycler)
+	bool occupied(int row)
 	{
-		if (RECYCLER_DEBUG)
-			cerr << "on top is already recycled" << endl;
-		return false;
+		return row >= 0 && row < MAX_HEIGHT && units[row] > 0;
 	}
-	if (game.get_case(pos.x, pos.y + 1).in_range_of_recycler)
+	int count(int row)
 	{
-		if (RECYCLER_DEBUG)
-			cerr << "on bottome is already recycled" << endl;
-		return false;
+		return row >= 0 && row < MAX_HEIGHT ? units[row] : 0;
 	}
-	if (game.get_case(pos.x - 1, pos.y).in_range_of_recycler)
+	// Units in rows [from, to)
+	int units_between(int from, int to)
 	{
-		if (RECYCLER_DEBUG)
-			cerr << "on left is already recycled" << endl;
-		return false;
+		from = max(from, 0);
+		to = min(to, MAX_HEIGHT);
+		return from < to ? units_before[to] - units_before[from] : 0;
 	}
-	if (game.get_case(pos.x + 1, pos.y).in_range_of_recycler)
+	// Rows holding a unit in [from, to)
+	int rows_between(int from, int to)
 	{
-		if (RECYCLER_DEBUG)
-			cerr << "on right is already recycled" << endl;
-		return false;
+		from = max(from, 0);
+		to = min(to, MAX_HEIGHT);
+		return from < to ? rows_before[to] - rows_before[from] : 0;
 	}
-	if (game.get_case(pos.x + 1, pos.y).owner == PLAYER_ME && game.get_case(pos.x - 1, pos.y).owner == PLAYER_ME && game.get_case(pos.x, pos.y + 1).owner == PLAYER_ME && game.get_case(pos.x, pos.y - 1).owner == PLAYER_ME)
+
+private:
+	void extremes(vector<Bot> &bots, int index)
 	{
-		if (RECYCLER_DEBUG)
-			cerr << "in my teritory" << endl;
-		return false;
+		int row = bots[index].pos.y;
+		int x = bots[index].pos.x;
+		if (first[row] == -1 || x < bots[first[row]].pos.x || (x == bots[first[row]].pos.x && index < first[row]))
+			first[row] = index;
+		if (last[row] == -1 || x > bots[last[row]].pos.x || (x == bots[last[row]].pos.x && index < last[row]))
+			last[row] = index;
 	}
-	if (RECYCLER_DEBUG)
-		cerr << "valid" << endl;
-	return true;
-}
+};
+
+/*=======================================================================
+||                               Actions                               ||
+=======================================================================*/
+enum ActionType
+{
+	ACTION_MOVE,
+	ACTION_BUILD,
+	ACTION_SPAWN
+};
 
-vector<Case> adajcent(Case &src, Game &game)
+// Plain 8 byte value: from/to for a MOVE, from only for BUILD and SPAWN
+class Action
 {
-	vector<Case> result;
-	if (src.pos.x > 0)
+public:
+	uint8_t type;
+	int16_t amount;
+	int8_t from_x;
+	int8_t from_y;
+	int8_t to_x;
+	int8_t to_y;
+	Action()
 	{
-		result.push_back(game.get_case(src.pos.x - 1, src.pos.y));
+		type = ACTION_MOVE;
+		amount = 0;
+		from_x = from_y = to_x = to_y = -1;
 	}
-	if (src.pos.x < game.width - 1)
+	static Action move(Position from, Position to, int amount_of_units)
 	{
-		result.push_back(game.get_case(src.pos.x + 1, src.pos.y));
+		Action action;
+		action.type = ACTION_MOVE;
+		action.amount = amount_of_units;
+		action.from_x = from.x;
+		action.from_y = from.y;
+		action.to_x = to.x;
+		action.to_y = to.y;
+		return action;
 	}
-	if (src.pos.y > 0)
+	static Action build(Position pos)
 	{
-		result.push_back(game.get_case(src.pos.x, src.pos.y - 1));
+		Action action;
+		action.type = ACTION_BUILD;
+		action.from_x = pos.x;
+		action.from_y = pos.y;
+		return action;
 	}
-	if (src.pos.y < game.height - 1)
+	static Action spawn(Position pos, int amount_of_units)
 	{
-		result.push_back(game.get_case(src.pos.x, src.pos.y + 1));
+		Action action;
+		action.type = ACTION_SPAWN;
+		action.amount = amount_of_units;
+		action.from_x = pos.x;
+		action.from_y = pos.y;
+		return action;
 	}
-	return result;
-}
-
-vector<Case> not_mine_available_to_move(Game &game)
-{
-	vector<Case> result;
-	for (auto it = game.cases.begin(); it != game.cases.end(); it++)
+	Position from()
 	{
-		if (it->owner != PLAYER_ME && it->scrap_amount > 0)
-		{
-			result.push_back(*it);
-		}
+		return Position(from_x, from_y);
 	}
-	return result;
-}
-
-vector<Case> other_cases(Game &game)
-{
-	vector<Case> result;
-	for (auto it = game.cases.begin(); it != game.cases.end(); it++)
+	Position to()
 	{
-		if (it->owner == PLAYER_OPPONENT)
-		{
-			result.push_back(*it);
-		}
+		return Position(to_x, to_y);
 	}
-	return result;
-}
-
-void init_recycler(Game &game)
-{
-	if (game.get_case(game.my_bots[0].pos.x, game.my_bots[0].pos.y + 1).scrap_amount >= 8)
-	{
-		game.register_action(new ActionBuildRecycler(Position(game.my_bots[0].pos.x, game.my_bots[0].pos.y + 1)));
-	}
-}
-
-bool is_bot_on_line(Game &game, int height)
-{
-	for (auto it = game.my_bots.begin(); it != game.my_bots.end(); it++)
+	int matterRemove()
 	{
-		if (it->pos.y == height)
-		{
-			return true;
-		}
+		return type == ACTION_MOVE ? 0 : 10;
 	}
-}
+};
 
-int count_bot_on_line(Game &game, int height)
-{
-	int result = 0;
-	for (auto it = game.my_bots.begin(); it != game.my_bots.end(); it++)
-	{
-		if (it->pos.y == height)
-		{
-			result++;
-		}
-	}
-	return result;
-}
+#define MAX_ACTIONS 512
 
-Bot &get_most_advanced_on_line(Game &game, int direction, int height)
+// Fixed capacity list of the actions of one turn, copied by value
+class ActionBuffer
 {
-	vector<Bot *> onLine;
-	for (auto it = game.my_bots.begin(); it != game.my_bots.end(); it++)
+public:
+	Action actions[MAX_ACTIONS];
+	int size;
+	ActionBuffer()
 	{
-		if (it->pos.y == height)
-		{
-			onLine.push_back(&(*it));
-		}
+		size = 0;
 	}
-	if (onLine.size() == 1)
+	ActionBuffer(const ActionBuffer &other)
 	{
-		return *onLine.front();
+		*this = other;
 	}
-	else
+	ActionBuffer &operator=(const ActionBuffer &other)
 	{
-		if (direction == -1)
-		{
-			return *onLine.front();
-		}
-		else
-		{
-			return *onLine.back();
-		}
+		size = other.size;
+		copy(other.actions, other.actions + other.size, actions);
+		return *this;
 	}
-}
-
-int line_with_bot_in(Game &game, int src, int direction)
-{
-	int result = 0;
-	for (int i = src; i >= 0 && i < game.height; i += direction)
+	Action *begin()
 	{
-		if (is_bot_on_line(game, i))
-		{
-			result++;
-		}
+		return actions;
 	}
-	return result;
-}
-
-bool is_line_util(Game &game, int h, int w, int direction)
-{
-	Position target = Position(w, h);
-	while (target.x >= 0 && target.x < game.width)
+	Action *end()
 	{
-		Case &c = game.get_case(target.x, target.y);
-		if (c.scrap_amount <= 0 || c.recycler > 0)
-		{
-			break;
-		}
-		if (c.owner == PLAYER_OPPONENT)
-		{
-			return true;
-		}
-		target.x += direction;
+		return actions + size;
 	}
-	return (direction == 1 && target.x > game.width / 2) || (direction == -1 && target.x < game.width / 2);
-}
-
-bool is_line_with_no_bot_in(Game &game, int src, int direction, int w)
-{
-	int available = 0;
-	for (int i = src; i >= 0 && i < game.height; i += direction)
+	Action &operator[](int index)
 	{
-		if (!is_bot_on_line(game, i) && is_line_util(game, i, w, direction))
-		{
-			available--;
-			if (available <= 0)
-				return true;
-		}
-		else if (i != src)
-		{
-			available += count_bot_on_line(game, i) - 1;
-		}
+		return actions[index];
 	}
-	return false;
-}
-
-void move_top_up(Game &game, int h, Position init_pos, int quantity, int direction)
-{
-	Position dest = Position(0, 0);
-	if (line_with_bot_in(game, h, 1) > line_with_bot_in(game, h, -1))
+	// False once the buffer is full; the action is dropped
+	bool push_back(Action action)
 	{
-		// More bots on the bottom, better is to go top
-		if (is_line_with_no_bot_in(game, h, -1, init_pos.x))
-		{
-			// There is a needed line in the top, go to top
-			dest = Position(init_pos.x, init_pos.y - 1);
-		}
-		else if (is_line_with_no_bot_in(game, h, 1, init_pos.x))
-		{
-			// There is no needed line in the top, go to bottom
-			dest = Position(init_pos.x, init_pos.y + 1);
-		}
-		else
-		{
-			// There is no needed line in the top, go to bottom
-			dest = Position(init_pos.x + direction, init_pos.y);
-		}
+		if (size == MAX_ACTIONS)
+			return false;
+		actions[size++] = action;
+		return true;
 	}
-	else
+	void erase(Action *it)
 	{
-		// More bots on the top, better is to go bottom
-		if (is_line_with_no_bot_in(game, h, 1, init_pos.x))
-		{
-			// There is a needed line in the bottom, go to bottom
-			dest = Position(init_pos.x, init_pos.y + 1);
-		}
-		else if (is_line_with_no_bot_in(game, h, -1, init_pos.x))
-		{
-			// There is no needed line in the bottom, go to top
-			dest = Position(init_pos.x, init_pos.y - 1);
-		}
-		else
-		{
-			// There is no needed line in the bottom, go to bottom
-			dest = Position(init_pos.x + direction, init_pos.y);
-		}
+		copy(it + 1, end(), it);
+		size--;
 	}
-	if (game.get_case(dest).recycler > 0 || game.get_case(dest).scrap_amount <= 0)
+	void clear()
 	{
-		dest = Position(init_pos.x - direction, init_pos.y);
+		size = 0;
 	}
-	game.register_action(new ActionMove(init_pos, dest, quantity));
-}
-
-bool is_available_for_defend(Case target)
-{
-	return target.owner == PLAYER_ME && target.scrap_amount > 0 && target.recycler == 0 && target.units == 0;
-}
+};
 
-void expand(Game &game, int direction, vector<Bot> available)
+/*=======================================================================
+||                             BoardState                              ||
+=======================================================================*/
+// Everything the referee rules need and nothing else, so the forward model
+// can be cloned by plain copy during search
+class BoardState
 {
-	// Build recycler to block ennemy
-	for (auto it = game.opp_bots.begin(); it != game.opp_bots.end(); it++)
+public:
+	Grid grid;
+	int matter[2];
+	BoardState(Grid &grid, int opp_matter, int my_matter) : grid(grid)
 	{
-		if (game.my_matter < 10)
-			break;
-		Position target = Position(it->pos.x - direction, it->pos.y);
-		if (is_available_for_defend(game.get_case(target)))
-			game.register_action(new ActionBuildRecycler(target));
+		matter[PLAYER_OPPONENT] = opp_matter;
+		matter[PLAYER_ME] = my_matter;
 	}
-	for (auto it = game.opp_bots.begin(); it != game.opp_bots.end(); it++)
+	// Builds, then moves and spawns simultaneously, fights, painting,
+	// recycling, grass and matter income
+	void step(ActionBuffer &actions_me, ActionBuffer &actions_opp)
 	{
-		if (game.my_matter < 10)
-			break;
-		Position target = Position(it->pos.x, it->pos.y + 1);
-		if (is_available_for_defend(game.get_case(target)))
-			game.register_action(new ActionBuildRecycler(target));
-		if (game.my_matter < 10)
-			break;
-		target = Position(it->pos.x, it->pos.y - 1);
-		if (is_available_for_defend(game.get_case(target)))
-			game.register_action(new ActionBuildRecycler(target));
+		step(actions_me, actions_opp, RuntimeDims(grid.width, grid.height));
 	}
-
-	Position spawner;
-	int dist = 1000;
-	// Parcour lignes
-	for (int h = 0; h < game.height; h++)
+	template <class Dims>
+	void step(ActionBuffer &actions_me, ActionBuffer &actions_opp, Dims dims)
 	{
-		if (is_bot_on_line(game, h))
+		ActionBuffer *actions[2];
+		actions[PLAYER_OPPONENT] = &actions_opp;
+		actions[PLAYER_ME] = &actions_me;
+
+		// Builds
+		for (int p = 0; p < 2; p++)
 		{
-			// Set director direction
-			Bot &director = get_most_advanced_on_line(game, direction, h);
-			Position target = Position(director.pos.x + direction, director.pos.y);
-			if (game.get_case(target).scrap_amount > 0 && game.get_case(target).recycler <= 0 && ((game.get_case(target.x + direction, target.y).scrap_amount > 0 && game.get_case(target.x + direction, target.y).recycler <= 0) || (game.get_case(target.x, target.y + 1).scrap_amount > 0 && game.get_case(target.x, target.y + 1).recycler <= 0) || (game.get_case(target.x, target.y - 1).scrap_amount > 0 && game.get_case(target.x, target.y - 1).recycler <= 0)))
-				game.register_action(new ActionMove(director.pos, target, 1));
-			else
+			for (auto it = actions[p]->begin(); it != actions[p]->end(); it++)
 			{
-				move_top_up(game, h, director.pos, 1, direction);
+				if (it->type != ACTION_BUILD || matter[p] < 10 || !grid.is_walkable(it->from()))
+					continue;
+				int index = grid.index(it->from());
+				if (grid.owner[index] != p || grid.units[index] > 0)
+					continue;
+				grid.set_recycler(index, true);
+				matter[p] -= 10;
 			}
-			// Set other bots direction
-			for (int w = director.pos.x; w >= 0 && w < game.width; w -= direction)
+		}
+
+		// Moves and spawns
+		int units[2][MAX_CASES];
+		int movable[2][MAX_CASES];
+		for (int p = 0; p < 2; p++)
+		{
+			for (int i = 0; i < dims.size; i++)
 			{
-				int usable = game.get_case(w, h).owner == PLAYER_ME ? game.get_case(w, h).units : 0;
-				if (w == director.pos.x)
+				units[p][i] = grid.owner[i] == p ? grid.units[i] : 0;
+				movable[p][i] = units[p][i];
+			}
+		}
+		for (int p = 0; p < 2; p++)
+		{
+			for (auto it = actions[p]->begin(); it != actions[p]->end(); it++)
+			{
+				if (it->type == ACTION_MOVE)
 				{
-					usable -= 1;
+					if (!grid.is_walkable(it->from()) || it->from() == it->to() || it->amount <= 0)
+						continue;
+					int from = grid.index(it->from());
+					int amount = min((int)it->amount, movable[p][from]);
+					if (amount <= 0)
+						continue;
+					Position next = grid.next_step(it->from(), it->to(), dims);
+					if (next == it->from())
+						continue;
+					movable[p][from] -= amount;
+					units[p][from] -= amount;
+					units[p][grid.index(next)] += amount;
+					continue;
 				}
-				if (usable > 0)
+				if (it->type == ACTION_SPAWN)
 				{
-					move_top_up(game, h, Position(w, h), usable, direction);
+					if (!grid.is_walkable(it->from()) || grid.owner[grid.index(it->from())] != p)
+						continue;
+					int amount = min((int)it->amount, matter[p] / 10);
+					if (amount <= 0)
+						continue;
+					matter[p] -= amount * 10;
+					units[p][grid.index(it->from())] += amount;
 				}
 			}
-			// Spawn new bot on the middle
-			int d = abs(line_with_bot_in(game, h, 1) - line_with_bot_in(game, h, -1));
-			if (d < dist)
+		}
+
+		// Fights and painting
+		for (int i = 0; i < dims.size; i++)
+		{
+			int killed = min(units[PLAYER_ME][i], units[PLAYER_OPPONENT][i]);
+			units[PLAYER_ME][i] -= killed;
+			units[PLAYER_OPPONENT][i] -= killed;
+			int owner = grid.owner[i];
+			int count = 0;
+			for (int p = 0; p < 2; p++)
 			{
-				dist = d;
-				spawner = director.pos;
+				if (units[p][i] > 0)
+				{
+					owner = p;
+					count = units[p][i];
+				}
 			}
+			grid.set_owner(i, owner);
+			grid.set_units(i, count);
 		}
-	}
-	if (dist < 1000)
-	{
-		if (game.my_matter >= 10)
-			game.register_action(new ActionSpawn(spawner, 1));
-	}
-	for (auto it = game.cases.begin(); it != game.cases.end(); it++)
-	{
-		if (it->owner != PLAYER_ME)
-			continue;
-		if (game.my_matter < 10)
-			break;
-		bool near = is_bot_on_line(game, it->pos.y);
-		for (auto it2 = available.begin(); it2 != available.end(); it2++)
+
+		// Recycling: a cell is harvested once per turn, but every player with
+		// a recycler in range of it earns one matter
+		uint8_t harvested[MAX_CASES] = {0};
+		for (int p = 0; p < 2; p++)
 		{
-			if (it->pos.distance(it2->pos) <= 2)
+			uint8_t earned[MAX_CASES] = {0};
+			for (int i = 0; i < dims.size; i++)
 			{
-				near = true;
-				break;
+				if (!(grid.flags[i] & CASE_RECYCLER) || grid.owner[i] != p)
+					continue;
+				int x = i % dims.width;
+				int around[5] = {i, x > 0 ? i - 1 : -1, x < dims.width - 1 ? i + 1 : -1, i >= dims.width ? i - dims.width : -1, i + dims.width < dims.size ? i + dims.width : -1};
+				for (int n = 0; n < 5; n++)
+				{
+					if (around[n] >= 0 && grid.scrap[around[n]] > 0)
+					{
+						harvested[around[n]] = 1;
+						earned[around[n]] = 1;
+					}
+				}
 			}
+			for (int i = 0; i < dims.size; i++)
+				matter[p] += earned[i];
 		}
-		if (!near)
+
+		// Grass
+		for (int i = 0; i < dims.size; i++)
 		{
-			game.register_action(new ActionSpawn(it->pos, 1));
+			if (!harvested[i])
+				continue;
+			grid.set_scrap(i, grid.scrap[i] - 1);
+			if (grid.scrap[i] <= 0)
+			{
+				grid.set_owner(i, PLAYER_NONE);
+				grid.set_units(i, 0);
+				grid.set_recycler(i, false);
+			}
 		}
+		matter[PLAYER_OPPONENT] += 10;
+		matter[PLAYER_ME] += 10;
+		grid.refresh_flags(dims);
+	}
+};
+
+/*=======================================================================
+||                             InputReader                             ||
+=======================================================================*/
+#define INPUT_BUFFER_SIZE (1 << 16)
+
+// Integer scanner over a file descriptor or a block of memory. A turn
+// block is a few kilobytes, so one read() usually brings all of it.
+class InputReader
+{
+public:
+	int fd;
+	const char *data;
+	vector<char> storage;
+	int begin;
+	int end;
+	bool eof;
+	InputReader(int fd)
+	{
+		this->fd = fd;
+		this->storage.resize(INPUT_BUFFER_SIZE);
+		this->data = storage.data();
+		this->begin = 0;
+		this->end = 0;
+		this->eof = false;
+	}
+	InputReader(const char *data, int size)
+	{
+		this->fd = -1;
+		this->data = data;
+		this->begin = 0;
+		this->end = size;
+		this->eof = false;
+	}
+	bool fill()
+	{
+		if (fd < 0)
+			return false;
+		char *buffer = storage.data();
+		int remaining = end - begin;
+		if (remaining > 0 && begin > 0)
+			copy(buffer + begin, buffer + end, buffer);
+		begin = 0;
+		end = remaining;
+		ssize_t n = read(fd, buffer + end, INPUT_BUFFER_SIZE - end);
+		if (n <= 0)
+			return false;
+		end += n;
+		return true;
 	}
-	if (available.size() == 0)
+	int next_int()
 	{
-		for (auto it = game.cases.begin(); it != game.cases.end(); it++)
+		while (true)
 		{
-			if (it->owner == PLAYER_ME && it->units > 0)
+			if (begin == end && !fill())
 			{
-				game.register_action(new ActionSpawn(it->pos, 1));
-				break;
+				eof = true;
+				return 0;
 			}
+			char c = data[begin];
+			if (c == '-' || (unsigned)(c - '0') <= 9)
+				break;
+			begin++;
+		}
+		bool negative = data[begin] == '-';
+		begin += negative;
+		int value = 0;
+		while (begin < end || fill())
+		{
+			unsigned digit = data[begin] - '0';
+			if (digit > 9)
+				break;
+			value = value * 10 + digit;
+			begin++;
 		}
+		return negative ? -value : value;
 	}
+};
+
+/*=======================================================================
+||                       ActionManager prototype                       ||
+=======================================================================*/
+class Game;
+class ActionManager
+{
+public:
+	ActionBuffer actions;
+	string message;
+	ActionManager();
+	bool addAction(Game *game, Action action);
+	int serialize(char *output, int capacity);
+	void execute();
+	void clear();
+};
+
+/*=======================================================================
+||                           Game prototype                            ||
+=======================================================================*/
+class Teritory;
+class Game
+{
+public:
+	int width;
+	int height;
+	int my_matter;
+	int opp_matter;
+	Grid grid;
+	// One Bot per occupied cell, in cell order; bot_at[cell] is its index in
+	// the owner's list or -1
+	vector<Bot> my_bots;
+	vector<Bot> opp_bots;
+	int16_t bot_at[MAX_CASES];
+	RowIndex my_rows;
+	vector<Teritory> teritories;
+	int16_t teritory_ids[MAX_CASES];
+	// Place of each cell in its territory's cases, and the grid the
+	// territories were last brought up to date with
+	int16_t teritory_slots[MAX_CASES];
+	Grid teritory_grid;
+	CellSet teritory_cells;
+	bool teritories_stale;
+	DistanceField not_mine_distance;
+	bool distances_stale;
+	AssignmentSolver assignment;
+	BoardPlanes board_planes;
+	bool planes_stale;
+	RecyclerMap recycler_map;
+	bool recycler_map_stale;
+	ThreatModel threats;
+	ActionManager action_manager;
+	int expand_dir;
+	Game(int width, int height);
+	void read_inputs(InputReader &in);
+	void write_inputs(ostream &out);
+	bool register_action(Action action);
+	void execute_actions();
+	Case get_case(Position pos);
+	Case get_case(int x, int y);
+	vector<Teritory> get_teritories();
+	void build_teritories();
+	void update_teritories();
+	void update_distances();
+	BoardPlanes &planes();
+	RecyclerMap &recyclers();
+	Position nearest(DistanceField &field, Position from);
+	Position nearest_in(Position from, CellSet &targets);
+	Bot &getBot(Position pos);
+	void collect_bots();
+	bool is_walkable(Position pos);
+	Position next_step(Position from, Position to);
+	void refresh_cases();
+	void step(ActionBuffer &actions_me, ActionBuffer &actions_opp);
+};
+
+/*=======================================================================
+||                         Territory prototype                         ||
+=======================================================================*/
+class Teritory
+{
+public:
+	vector<Case> cases;
+	CellSet cells;
+	vector<Bot> my_bots;
+	vector<Bot> opp_bots;
+	RowIndex my_rows;
+	Mode mode;
+	Player owner;
+	int id;
+	Teritory();
+	Teritory(const Teritory &t);
+	void operator=(const Teritory &t);
+	void add_case(Case c, int index);
+	void add_bot(Case &c);
+	bool is_in(int index);
+	bool is_in(Game &game, Position pos);
+	int size();
+	CellSet not_mine(Game &game);
+	void addCaseAndNeighbours(Game &game, Case &c);
+	void addCaseAndNeighbours(Game &game, Case &c, int xDir, int yDir);
+	void buildFrom(Game &game, Case &c);
+	void buildFrom(Game &game, Case &c, int xDir, int yDir);
+	void refresh(Game &game, CellSet &changed);
+	bool isIsolate();
+	bool isIsolateWithCase();
+	Bot &move_unit(int index, Position to);
+};
+
+/*=======================================================================
+||                      ActionManager declaration                      ||
+=======================================================================*/
+ActionManager::ActionManager() {}
+// Matter is only charged for actions that fit in the buffer
+bool ActionManager::addAction(Game *game, Action action)
+{
+	if (action.type == ACTION_SPAWN && action.amount <= 0)
+		return false;
+	if (!actions.push_back(action))
+		return false;
+	game->my_matter -= action.matterRemove();
+	return true;
 }
 
-void splatoon(Game &game, vector<Bot> available)
+#define OUTPUT_BUFFER_SIZE (MAX_ACTIONS * 32 + 256)
+
+char *write_int(char *out, int value)
 {
-	vector<Case> notMine;
-	for (auto it = game.cases.begin(); it != game.cases.end(); it++)
+	char digits[12];
+	int size = 0;
+	if (value < 0)
 	{
-		if (it->owner == PLAYER_NONE && it->scrap_amount > 0)
-		{
-			notMine.push_back(*it);
-		}
+		*out++ = '-';
+		value = -value;
 	}
-	vector<Bot> myBots = available;
-	for (auto it = notMine.begin(); it != notMine.end(); it++)
+	do
 	{
-		if (myBots.size() == 0)
-			break;
-		Position closest = get_nearest(it->pos, myBots);
-		game.register_action(new ActionMove(closest, it->pos, 1));
-		for (auto it2 = myBots.begin(); it2 != myBots.end(); it2++)
+		digits[size++] = '0' + value % 10;
+		value /= 10;
+	} while (value > 0);
+	while (size > 0)
+		*out++ = digits[--size];
+	return out;
+}
+
+char *write_text(char *out, const char *text)
+{
+	while (*text)
+		*out++ = *text++;
+	return out;
+}
+
+// Writes the whole turn line into `output` and returns its length.
+// MOVEs sharing the same from and to, and SPAWNs on the same cell, are
+// sent once with their amounts summed, at the place of the first one.
+int ActionManager::serialize(char *output, int capacity)
+{
+	int amounts[MAX_ACTIONS];
+	uint32_t keys[MAX_ACTIONS];
+	for (int i = 0; i < actions.size; i++)
+	{
+		Action &action = actions[i];
+		amounts[i] = action.amount;
+		keys[i] = (uint8_t)action.from_x | (uint8_t)action.from_y << 8;
+		if (action.type == ACTION_MOVE)
+			keys[i] |= (uint8_t)action.to_x << 16 | (uint32_t)(uint8_t)action.to_y << 24;
+		else if (action.type != ACTION_SPAWN)
+			continue;
+		for (int j = 0; j < i; j++)
 		{
-			if (it2->pos == closest)
+			if (amounts[j] >= 0 && actions[j].type == action.type && keys[j] == keys[i])
 			{
-				myBots.erase(it2);
+				amounts[j] += amounts[i];
+				amounts[i] = -1;
 				break;
 			}
 		}
 	}
-	for (auto it = myBots.begin(); it != myBots.end(); it++)
+
+	char *out = output;
+	for (int i = 0; i < actions.size; i++)
 	{
-		Position nearest = get_nearest(it->pos, notMine);
-		game.register_action(new ActionMove(it->pos, nearest, 1));
-		for (auto it2 = notMine.begin(); it2 != notMine.end(); it2++)
+		Action &action = actions[i];
+		if (amounts[i] < 0)
+			continue;
+		if (out != output)
+			*out++ = ';';
+		if (action.type == ACTION_MOVE)
+		{
+			out = write_text(out, "MOVE ");
+			out = write_int(out, amounts[i]);
+			*out++ = ' ';
+			out = write_int(out, action.from_x);
+			*out++ = ' ';
+			out = write_int(out, action.from_y);
+			*out++ = ' ';
+			out = write_int(out, action.to_x);
+			*out++ = ' ';
+			out = write_int(out, action.to_y);
+		}
+		else if (action.type == ACTION_BUILD)
+		{
+			out = write_text(out, "BUILD ");
+			out = write_int(out, action.from_x);
+			*out++ = ' ';
+			out = write_int(out, action.from_y);
+		}
+		else
 		{
-			if (it2->pos == nearest)
-			{
-				notMine.erase(it2);
-				break;
-			}
+			out = write_text(out, "SPAWN ");
+			out = write_int(out, amounts[i]);
+			*out++ = ' ';
+			out = write_int(out, action.from_x);
+			*out++ = ' ';
+			out = write_int(out, action.from_y);
 		}
 	}
-	for (auto it = game.cases.begin(); it != game.cases.end(); it++)
+	if (message.size() > 0)
 	{
-		if (game.my_matter < 10)
-			break;
-		if (it->owner == PLAYER_ME && it->units < 1)
-		{
-			game.register_action(new ActionSpawn(it->pos, 1));
-		}
+		if (out != output)
+			*out++ = ';';
+		out = write_text(out, "MESSAGE ");
+		int room = capacity - (out - output) - 1;
+		int size = min((int)message.size(), room);
+		copy(message.begin(), message.begin() + size, out);
+		out += size;
 	}
+	if (out == output)
+		out = write_text(out, "WAIT");
+	*out++ = '\n';
+	return out - output;
 }
 
-bool isAllIsolate(Game &game)
+void ActionManager::execute()
 {
-	vector<Teritory> teritories = game.get_teritories();
-	for (auto it = teritories.begin(); it != teritories.end(); it++)
+	static char output[OUTPUT_BUFFER_SIZE];
+	int size = serialize(output, OUTPUT_BUFFER_SIZE);
+	for (int written = 0; written < size;)
 	{
-		if (!it->isIsolate())
-			return false;
+		ssize_t n = write(STDOUT_FILENO, output + written, size - written);
+		if (n <= 0)
+			break;
+		written += n;
 	}
-	return true;
+	clear();
 }
 
-bool is_bot_on_line(Teritory &teritory, int height)
+void ActionManager::clear()
 {
-	for (auto it = teritory.my_bots.begin(); it != teritory.my_bots.end(); it++)
-	{
-		if (it->pos.y == height)
-		{
-			return true;
-		}
-	}
+	actions.clear();
+	message.clear();
 }
 
-int count_bot_on_line(Teritory &teritory, int height)
+/*=======================================================================
+||                          Game declaration                           ||
+=======================================================================*/
+Game::Game(int width, int height) : grid(width, height), teritory_grid(width, height)
 {
-	int result = 0;
-	for (auto it = teritory.my_bots.begin(); it != teritory.my_bots.end(); it++)
+	this->width = width;
+	this->height = height;
+	this->my_matter = 0;
+	this->opp_matter = 0;
+	this->expand_dir = -1;
+	this->teritories_stale = false;
+	this->distances_stale = true;
+	this->planes_stale = true;
+	this->recycler_map_stale = true;
+	fill(bot_at, bot_at + MAX_CASES, -1);
+}
+
+void Game::read_inputs(InputReader &in)
+{
+	TraceScope scope(PHASE_READ_INPUTS);
+	teritories_stale = true;
+	distances_stale = true;
+	planes_stale = true;
+	recycler_map_stale = true;
+
+	my_matter = in.next_int();
+	opp_matter = in.next_int();
+	for (int index = 0; index < grid.size; index++)
+	{
+		grid.scrap[index] = in.next_int();
+		grid.owner[index] = convertToPlayer(in.next_int());
+		grid.units[index] = in.next_int();
+		int flags = in.next_int() ? CASE_RECYCLER : 0;
+		flags |= in.next_int() ? CASE_CAN_BUILD : 0;
+		flags |= in.next_int() ? CASE_CAN_SPAWN : 0;
+		flags |= in.next_int() ? CASE_IN_RANGE : 0;
+		grid.flags[index] = flags;
+		if (tracing(TRACE_INPUT))
+			trace(TRACE_INPUT, "read case", index % width, index / width, grid.units[index]);
+	}
+	collect_bots();
+	grid.rehash();
+#if THREAT_SPAWNS
+	threats.observe(grid);
+#endif
+	if (tracing(TRACE_INPUT))
+		trace(TRACE_INPUT, "inputs read", grid.size, my_matter, opp_matter);
+}
+
+// Same turn block as the referee sends, so that saved states can be read
+// back with read_inputs
+void Game::write_inputs(ostream &out)
+{
+	out << my_matter << " " << opp_matter << "\n";
+	for (int i = 0; i < grid.size; i++)
 	{
-		if (it->pos.y == height)
-		{
-			result++;
-		}
+		Case c = grid.get(i);
+		out << c.scrap_amount << " " << c.owner << " " << c.units << " " << c.recycler << " " << c.can_build << " " << c.can_spawn << " " << c.in_range_of_recycler << "\n";
 	}
-	return result;
+}
+
+// False when the action was dropped, so callers skip their own updates
+bool Game::register_action(Action action)
+{
+	if (action.type == ACTION_BUILD && !grid.is_in(action.from()))
+		return false;
+	if (!action_manager.addAction(this, action))
+		return false;
+	if (action.type == ACTION_BUILD)
+	{
+		int index = grid.index(action.from());
+		grid.set_recycler(index, true);
+		grid.flags[index] = CASE_RECYCLER | CASE_IN_RANGE;
+		planes_stale = true;
+		recycler_map_stale = true;
+	}
+	return true;
+}
+
+void Game::execute_actions()
+{
+	TraceScope scope(PHASE_EXECUTE);
+	action_manager.execute();
+}
+
+Case Game::get_case(Position pos)
+{
+	// Outside of the map behaves like grass
+	if (!grid.is_in(pos))
+		return Case(pos, 0, PLAYER_NONE, 0, 0, 0, 0, 0);
+	return grid.get(grid.index(pos));
+}
+
+Case Game::get_case(int x, int y)
+{
+	return get_case(Position(x, y));
+}
+
+vector<Teritory> Game::get_teritories()
+{
+	TraceScope scope(PHASE_TERITORIES);
+	if (teritories.size() == 0)
+		build_teritories();
+	else if (teritories_stale)
+		update_teritories();
+	teritories_stale = false;
+	return teritories;
+}
+
+void Game::build_teritories()
+{
+	teritories.clear();
+	teritory_cells = grid.walkable();
+	fill(teritory_ids, teritory_ids + grid.size, -1);
+	for (int i = 0; i < grid.size; i++)
+	{
+		if (grid.is_walkable(i) && teritory_ids[i] == -1)
+		{
+			Teritory t = Teritory();
+			Case c = grid.get(i);
+			t.buildFrom(*this, c);
+			teritories.push_back(t);
+		}
+	}
+	teritory_grid = grid;
+	if (tracing(TRACE_TERRITORY))
+	{
+		for (auto it = teritories.begin(); it != teritories.end(); it++)
+			trace(TRACE_TERRITORY, "territory", it->cases[0].pos.x, it->cases[0].pos.y, it->size());
+	}
+}
+
+// Cells only ever leave the walkable set (grass or new recycler), so only
+// the territories that lost a cell can split. They are relabelled from
+// scratch, the others only patch the cells that changed since the last
+// update. The result is the same as build_teritories.
+void Game::update_teritories()
+{
+	CellSet walkable = grid.walkable();
+	if (!(walkable - teritory_cells).empty())
+	{
+		build_teritories();
+		return;
+	}
+	CellSet removed = teritory_cells - walkable;
+	teritory_cells = walkable;
+	CellSet changed;
+	for (int i = 0; i < grid.size; i++)
+	{
+		if (grid.scrap[i] != teritory_grid.scrap[i] || grid.owner[i] != teritory_grid.owner[i] || grid.units[i] != teritory_grid.units[i] || grid.flags[i] != teritory_grid.flags[i])
+			changed.set(i);
+	}
+	teritory_grid = grid;
+	if (removed.empty())
+	{
+		for (auto it = teritories.begin(); it != teritories.end(); it++)
+			it->refresh(*this, changed);
+		return;
+	}
+
+	CellSet relabel;
+	for (auto it = teritories.begin(); it != teritories.end(); it++)
+	{
+		if ((it->cells & removed).empty())
+			it->refresh(*this, changed);
+		else
+			relabel |= it->cells;
+	}
+	teritories.erase(remove_if(teritories.begin(), teritories.end(), [&](const Teritory &t)
+							   { return !(t.cells & removed).empty(); }),
+					 teritories.end());
+	for (int i = relabel.first(); i != -1; i = relabel.next(i))
+		teritory_ids[i] = -1;
+	relabel &= walkable;
+	for (int i = relabel.first(); i != -1; i = relabel.next(i))
+	{
+		if (teritory_ids[i] != -1)
+			continue;
+		Teritory t = Teritory();
+		Case c = grid.get(i);
+		t.buildFrom(*this, c);
+		teritories.push_back(t);
+	}
+
+	// Same order and ids as a full build: by first cell on the board
+	sort(teritories.begin(), teritories.end(), [](const Teritory &a, const Teritory &b)
+		 { return a.cells.first() < b.cells.first(); });
+	for (size_t k = 0; k < teritories.size(); k++)
+	{
+		if (teritories[k].id == (int)k)
+			continue;
+		teritories[k].id = k;
+		for (int i = teritories[k].cells.first(); i != -1; i = teritories[k].cells.next(i))
+			teritory_ids[i] = k;
+	}
+}
+
+BoardPlanes &Game::planes()
+{
+	if (planes_stale)
+	{
+		board_planes.build(grid);
+		planes_stale = false;
+	}
+	return board_planes;
+}
+
+RecyclerMap &Game::recyclers()
+{
+	if (recycler_map_stale)
+	{
+		recycler_map.compute(grid);
+		recycler_map_stale = false;
+	}
+	return recycler_map;
+}
+
+// One multi-source BFS per field, done on the first query of a turn
+void Game::update_distances()
+{
+	CellSet not_mine;
+	for (int i = 0; i < grid.size; i++)
+	{
+		if (grid.owner[i] != PLAYER_ME && grid.is_walkable(i))
+			not_mine.set(i);
+	}
+	not_mine_distance.compute(grid, not_mine);
+	distances_stale = false;
+}
+
+// Closest source of `field` walking from `from`, or `from` if none
+Position Game::nearest(DistanceField &field, Position from)
+{
+	if (distances_stale)
+		update_distances();
+	if (!grid.is_in(from) || field.nearest[grid.index(from)] == -1)
+		return from;
+	return grid.position(field.nearest[grid.index(from)]);
+}
+
+Position Game::nearest_in(Position from, CellSet &targets)
+{
+	if (!grid.is_in(from))
+		return from;
+	int index = DistanceField::nearest_in(grid, grid.index(from), targets);
+	return index == -1 ? from : grid.position(index);
+}
+
+Bot &Game::getBot(Position pos)
+{
+	int index = grid.is_in(pos) ? bot_at[grid.index(pos)] : -1;
+	if (index == -1)
+		return my_bots[0];
+	return grid.owner[grid.index(pos)] == PLAYER_ME ? my_bots[index] : opp_bots[index];
+}
+
+// One Bot per stack of units on the board
+void Game::collect_bots()
+{
+	my_bots.clear();
+	opp_bots.clear();
+	for (int i = 0; i < grid.size; i++)
+	{
+		bot_at[i] = -1;
+		if (grid.units[i] == 0)
+			continue;
+		if (grid.owner[i] == PLAYER_ME)
+		{
+			bot_at[i] = my_bots.size();
+			my_bots.push_back(Bot(grid.position(i), PLAYER_ME, grid.units[i]));
+		}
+		else if (grid.owner[i] == PLAYER_OPPONENT)
+		{
+			bot_at[i] = opp_bots.size();
+			opp_bots.push_back(Bot(grid.position(i), PLAYER_OPPONENT, grid.units[i]));
+		}
+	}
+	my_rows.build(my_bots);
+}
+
+/*=======================================================================
+||                        Simulator declaration                        ||
+=======================================================================*/
+
+bool Game::is_walkable(Position pos)
+{
+	return grid.is_in(pos) && grid.is_walkable(grid.index(pos));
+}
+
+Position Game::next_step(Position from, Position to)
+{
+	return grid.next_step(from, to);
+}
+
+// Recompute the flags the referee sends (always from my point of view) and
+// the bot lists after the board has been modified in place.
+void Game::refresh_cases()
+{
+	teritories_stale = true;
+	distances_stale = true;
+	planes_stale = true;
+	recycler_map_stale = true;
+	grid.rehash();
+	grid.refresh_flags();
+	collect_bots();
+}
+
+// Play one full turn of the referee rules on the current state
+void Game::step(ActionBuffer &actions_me, ActionBuffer &actions_opp)
+{
+	BoardState state(grid, opp_matter, my_matter);
+	state.step(actions_me, actions_opp);
+	grid = state.grid;
+	opp_matter = state.matter[PLAYER_OPPONENT];
+	my_matter = state.matter[PLAYER_ME];
+	refresh_cases();
+}
+
+/*=======================================================================
+||                         Territory declaration                       ||
+=======================================================================*/
+
+Teritory::Teritory() : mode(EXPAND), id(-1) {}
+
+Teritory::Teritory(const Teritory &t) { *this = t; }
+
+void Teritory::operator=(const Teritory &t)
+{
+	cases = t.cases;
+	cells = t.cells;
+	my_bots = t.my_bots;
+	opp_bots = t.opp_bots;
+	my_rows = t.my_rows;
+	id = t.id;
+}
+
+void Teritory::add_case(Case c, int index)
+{
+	cases.push_back(c);
+	cells.set(index);
+	add_bot(c);
+}
+
+void Teritory::add_bot(Case &c)
+{
+	if (c.units > 0)
+	{
+		if (c.owner == PLAYER_ME)
+		{
+			my_bots.push_back(Bot(c.pos, PLAYER_ME, c.units));
+			my_rows.add(my_bots, my_bots.size() - 1);
+		}
+		else if (c.owner == PLAYER_OPPONENT)
+		{
+			opp_bots.push_back(Bot(c.pos, PLAYER_OPPONENT, c.units));
+		}
+	}
+}
+
+bool Teritory::is_in(int index)
+{
+	return cells.test(index);
+}
+
+bool Teritory::is_in(Game &game, Position pos)
+{
+	return game.grid.is_in(pos) && cells.test(game.grid.index(pos));
+}
+
+int Teritory::size()
+{
+	return cells.count();
+}
+
+CellSet Teritory::not_mine(Game &game)
+{
+	return cells - game.grid.owned_by(PLAYER_ME);
+}
+
+void Teritory::addCaseAndNeighbours(Game &game, Case &c)
+{
+	addCaseAndNeighbours(game, c, 0, 0);
+}
+
+// Depth first walk with an explicit stack, visiting neighbours in board
+// order (top, left, right, bottom) like the former recursive scan did.
+// Cells are marked in game.teritory_ids, so each one is looked at once.
+// The direction only filters the neighbours of the starting case.
+void Teritory::addCaseAndNeighbours(Game &game, Case &c, int xDir, int yDir)
+{
+	static const int dx[4] = {0, -1, 1, 0};
+	static const int dy[4] = {-1, 0, 0, 1};
+	Grid &grid = game.grid;
+	int stack[MAX_CASES];
+	int next[MAX_CASES];
+	int size = 0;
+	int start = grid.index(c.pos);
+	add_case(c, start);
+	game.teritory_ids[start] = id;
+	game.teritory_slots[start] = cases.size() - 1;
+	stack[size] = start;
+	next[size++] = 0;
+	while (size > 0)
+	{
+		int current = stack[size - 1];
+		int direction = next[size - 1]++;
+		if (direction == 4)
+		{
+			size--;
+			continue;
+		}
+		Position pos = grid.position(current);
+		Position neighbour = Position(pos.x + dx[direction], pos.y + dy[direction]);
+		if (!grid.is_in(neighbour))
+			continue;
+		int index = grid.index(neighbour);
+		if (!grid.is_walkable(index) || game.teritory_ids[index] == id)
+			continue;
+		if (current == start)
+		{
+			if (!((xDir == 1 && neighbour.x >= pos.x) || (xDir == -1 && neighbour.x <= pos.x) || (xDir == 0)))
+				continue;
+			if (!((yDir == 1 && neighbour.y >= pos.y) || (yDir == -1 && neighbour.y <= pos.y) || (yDir == 0)))
+				continue;
+		}
+		add_case(grid.get(index), index);
+		game.teritory_ids[index] = id;
+		game.teritory_slots[index] = cases.size() - 1;
+		stack[size] = index;
+		next[size++] = 0;
+	}
+}
+
+// The territory takes the id it will have once pushed in game.teritories
+void Teritory::buildFrom(Game &game, Case &c)
+{
+	id = game.teritories.size();
+	if (tracing(TRACE_TERRITORY))
+		trace(TRACE_TERRITORY, "building territory", c.pos.x, c.pos.y);
+	addCaseAndNeighbours(game, c);
+	if (isIsolate())
+	{
+		mode = SPLATOON;
+	}
+}
+
+void Teritory::buildFrom(Game &game, Case &c, int xDir, int yDir)
+{
+	id = game.teritories.size();
+	if (tracing(TRACE_TERRITORY))
+		trace(TRACE_TERRITORY, "building territory", c.pos.x, c.pos.y);
+	addCaseAndNeighbours(game, c, xDir, yDir);
+	if (isIsolate())
+	{
+		mode = SPLATOON;
+	}
+}
+
+// Patch the `changed` cells of this territory in place. The bots, rows and
+// mode are only redone when an owner or a unit count moved.
+void Teritory::refresh(Game &game, CellSet &changed)
+{
+	CellSet touched = cells & changed;
+	bool moved = false;
+	for (int i = touched.first(); i != -1; i = touched.next(i))
+	{
+		Case &c = cases[game.teritory_slots[i]];
+		moved |= c.owner != game.grid.owner[i] || c.units != game.grid.units[i];
+		c = game.grid.get(i);
+	}
+	if (!moved)
+		return;
+	my_bots.clear();
+	opp_bots.clear();
+	my_rows.clear();
+	for (auto it = cases.begin(); it != cases.end(); it++)
+		add_bot(*it);
+	mode = isIsolate() ? SPLATOON : EXPAND;
+}
+
+bool Teritory::isIsolate()
+{
+	bool isolate = true;
+	owner = PLAYER_NONE;
+	for (auto it = cases.begin(); it != cases.end(); it++)
+	{
+		if (owner == PLAYER_NONE)
+		{
+			owner = it->owner;
+		}
+		else if (owner != it->owner && it->owner != PLAYER_NONE)
+		{
+			isolate = false;
+		}
+	}
+	return isolate;
+}
+
+bool Teritory::isIsolateWithCase()
+{
+	bool isolate = true;
+	owner = PLAYER_NONE;
+	for (auto it = cases.begin(); it != cases.end(); it++)
+	{
+		if (owner == PLAYER_NONE && it->units > 0)
+		{
+			owner = it->owner;
+		}
+		else if (owner != it->owner && it->owner != PLAYER_NONE && it->units > 0)
+		{
+			isolate = false;
+		}
+	}
+	return isolate;
+}
+
+// Sends one unit of my stack `index` to `to` for the rest of the turn's
+// line queries. It gets an entry of its own when the stack had more.
+Bot &Teritory::move_unit(int index, Position to)
+{
+	my_rows.remove(my_bots, index);
+	if (my_bots[index].units == 1)
+	{
+		my_bots[index].pos = to;
+		my_rows.add(my_bots, index);
+		return my_bots[index];
+	}
+	my_bots[index].units--;
+	my_rows.add(my_bots, index);
+	Bot moved = my_bots[index];
+	moved.pos = to;
+	moved.units = 1;
+	my_bots.push_back(moved);
+	my_rows.add(my_bots, my_bots.size() - 1);
+	return my_bots.back();
+}
+
+/*=======================================================================
+||                                                                     ||
+||                          Utils functions                            ||
+||                                                                     ||
+=======================================================================*/
+
+bool isCaseUsefulForRecycler(Game &game, Position pos)
+{
+	bool useful = game.grid.is_in(pos) && game.planes().useful_for_recycler().test(game.grid.index(pos));
+	if (tracing(TRACE_RECYCLER))
+		trace(TRACE_RECYCLER, "recycler candidate", pos.x, pos.y, useful);
+	return useful;
+}
+
+bool is_available_for_defend(Game &game, Position target)
+{
+	return game.grid.is_in(target) && game.planes().defendable().test(game.grid.index(target));
+}
+
+void splatoon(Game &game, vector<Bot> available)
+{
+	TraceScope scope(PHASE_SPLATOON);
+	Grid &grid = game.grid;
+	CellSet notMine;
+	for (int i = 0; i < grid.size; i++)
+	{
+		if (grid.owner[i] == PLAYER_NONE && grid.scrap[i] > 0)
+			notMine.set(i);
+	}
+	vector<int> units;
+	vector<int> targets;
+	vector<int> assigned;
+	for (auto it = available.begin(); it != available.end(); it++)
+	{
+		for (int u = 0; u < it->units; u++)
+			units.push_back(grid.index(it->pos));
+	}
+	for (int i = notMine.first(); i != -1; i = notMine.next(i))
+		targets.push_back(i);
+	game.assignment.solve(grid, units, targets, assigned);
+	for (size_t i = 0; i < units.size(); i++)
+	{
+		Position from = grid.position(units[i]);
+		Position to = assigned[i] == -1 ? game.nearest_in(from, notMine) : grid.position(targets[assigned[i]]);
+		game.register_action(Action::move(from, to, 1));
+	}
+	for (int i = 0; i < game.grid.size; i++)
+	{
+		if (game.my_matter < 10)
+			break;
+		if (game.grid.owner[i] == PLAYER_ME && game.grid.units[i] < 1)
+		{
+			game.register_action(Action::spawn(game.grid.position(i), 1));
+		}
+	}
+}
+
+bool isAllIsolate(Game &game)
+{
+	vector<Teritory> teritories = game.get_teritories();
+	for (auto it = teritories.begin(); it != teritories.end(); it++)
+	{
+		if (!it->isIsolate())
+			return false;
+	}
+	return true;
+}
+
+bool is_bot_on_line(Teritory &teritory, int height)
+{
+	return teritory.my_rows.occupied(height);
+}
+
+int count_bot_on_line(Teritory &teritory, int height)
+{
+	return teritory.my_rows.count(height);
 }
 
 Bot &get_most_advanced_on_line(Teritory &teritory, int xDir, int height)
 {
-	vector<Bot *> onLine;
+	RowIndex &rows = teritory.my_rows;
+	return teritory.my_bots[xDir == 1 ? rows.last[height] : rows.first[height]];
+}
+
+int count_bot_from(Game &game, Position from, Teritory &teritory, int yDir)
+{
+	if (yDir == 1)
+		return teritory.my_rows.units_between(from.y + 1, game.height);
+	return teritory.my_rows.units_between(0, from.y);
+}
+
+bool is_walkable(Game &game, Position pos)
+{
+	if (pos.x < 0 || pos.x >= game.width || pos.y < 0 || pos.y >= game.height)
+		return false;
+	if (game.get_case(pos).scrap_amount <= 0 || game.get_case(pos).recycler > 0)
+		return false;
+	return true;
+}
+
+bool is_line_covered(Game &game, Position from)
+{
+	if (from.y < 0 || from.y >= game.height)
+		return true;
+	bool covered = false;
+	for (int w = from.x; w >= 0 && w < game.width; w--)
+	{
+		if (game.get_case(w, from.y).scrap_amount <= 0)
+			break;
+		if (game.get_case(w, from.y).owner == PLAYER_ME)
+		{
+			covered = true;
+			break;
+		}
+	}
+	if (covered)
+		return true;
+	for (int w = from.x; w >= 0 && w < game.width; w++)
+	{
+		if (game.get_case(w, from.y).scrap_amount <= 0)
+			break;
+		if (game.get_case(w, from.y).owner == PLAYER_ME)
+		{
+			covered = true;
+			break;
+		}
+	}
+	return covered;
+}
+
+void expand(Game &game, Teritory &teritory, Position spawn, Position middle, int xDir)
+{
+	TraceScope scope(PHASE_EXPAND);
+	game.expand_dir *= -1;
+	int dir = game.expand_dir;
+	vector<Position> directors;
+	vector<Case> front_line;
+	// Owned cells with a free walkable cell behind them
+	BoardPlanes &planes = game.planes();
+	CellSet frontier = (planes.mine - planes.recycler) & planes.translate(planes.walkable - planes.opponent, xDir, 0);
+	for (int h = (dir == 1 ? 0 : game.height - 1); h < game.height && h >= 0; h += dir)
+	{
+		int row_end = (h + 1) * game.width;
+		int front = -1;
+		for (int i = frontier.next(h * game.width - 1); i != -1 && i < row_end; i = frontier.next(i))
+		{
+			front = i;
+			if (xDir == -1)
+				break;
+		}
+		if (front != -1)
+			front_line.push_back(game.grid.get(front));
+		if (is_bot_on_line(teritory, h))
+		{
+			Bot *director = &get_most_advanced_on_line(teritory, xDir, h);
+			Position target = Position(director->pos.x + xDir, h);
+			if (is_walkable(game, Position(director->pos.x - xDir, h)) && game.get_case(Position(director->pos.x - xDir, h)).owner != PLAYER_OPPONENT)
+				directors.push_back(director->pos);
+			if (!is_walkable(game, target) || game.get_case(target).owner == PLAYER_ME)
+			{
+				target = Position(director->pos.x, h + (director->pos.y < middle.y ? 1 : -1));
+				if (!is_walkable(game, target) || game.get_case(target).owner == PLAYER_ME)
+				{
+					target = Position(director->pos.x, h + (director->pos.y < middle.y ? -1 : 1));
+					if (!is_walkable(game, target) || game.get_case(target).owner == PLAYER_ME)
+					{
+						Position dest = game.nearest(game.not_mine_distance, director->pos);
+						game.register_action(Action::move(director->pos, dest, 1));
+					}
+				}
+			}
+			// Every fallback may be blocked or off the map; then it stays put
+			if (is_walkable(game, target) && game.register_action(Action::move(director->pos, target, 1)))
+				director = &teritory.move_unit(director - &teritory.my_bots[0], target);
+			for (int w = director->pos.x; w >= 0 && w < game.width; w -= xDir)
+			{
+				int usable = game.get_case(w, h).owner == PLAYER_ME ? game.get_case(w, h).units : 0;
+				Position origin = Position(w, h);
+				if (w == director->from.x)
+				{
+					usable -= 1;
+				}
+				if (usable > 0)
+				{
+					target = Position(origin.x, h + dir);
+					if (!is_walkable(game, target) || is_line_covered(game, target))
+					{
+						target = Position(origin.x, h - dir);
+						if (!is_walkable(game, target) || is_line_covered(game, target))
+						{
+							target = Position(origin.x, h + 1);
+							if (!is_walkable(game, target) || game.get_case(target).owner == PLAYER_ME)
+							{
+								target = Position(origin.x, h - 1);
+								if (!is_walkable(game, target) || game.get_case(target).owner == PLAYER_ME)
+								{
+									target = game.nearest(game.not_mine_distance, origin);
+								}
+							}
+						}
+					}
+					game.register_action(Action::move(origin, target, usable));
+				}
+			}
+		}
+	}
+	if (tracing(TRACE_EXPAND))
+		trace(TRACE_EXPAND, "front line and directors", front_line.size(), directors.size(), teritory.id);
+	for (auto it = directors.begin(); it != directors.end(); it++)
+	{
+		if (game.my_matter < 10)
+			break;
+		Position target = Position(it->x, it->y + dir);
+		if (is_walkable(game, target) && !is_line_covered(game, target))
+		{
+			game.register_action(Action::spawn(*it, 1));
+			break;
+		}
+		target = Position(it->x, it->y - dir);
+		if (is_walkable(game, target) && !is_line_covered(game, target))
+			game.register_action(Action::spawn(*it, 1));
+	}
 	for (auto it = teritory.my_bots.begin(); it != teritory.my_bots.end(); it++)
 	{
-		if (it->pos.y == height)
+		if (game.my_matter < 10)
+			break;
+		for (auto it2 = teritory.opp_bots.begin(); it2 != teritory.opp_bots.end(); it2++)
+		{
+			if (it->from.distance(it2->pos) <= 1)
+			{
+				for (int u = 0; u < it->units && game.my_matter >= 10; u++)
+					game.register_action(Action::spawn(it->from, 1));
+				break;
+			}
+		}
+	}
+	for (auto it = front_line.begin(); it != front_line.end(); it++)
+	{
+		if (game.my_matter < 10)
+			break;
+		if (it->units == 0)
+		{
+			game.register_action(Action::spawn(it->pos, 1));
+		}
+	}
+}
+
+void splatoon(Game &game, Teritory &teritory)
+{
+	TraceScope scope(PHASE_SPLATOON);
+	CellSet notMine = teritory.not_mine(game);
+	if (teritory.my_bots.size() == 0)
+	{
+		for (auto it = teritory.cases.begin(); it != teritory.cases.end(); it++)
 		{
-			onLine.push_back(&(*it));
+			if (it->owner == PLAYER_ME && it->scrap_amount > 0 && it->recycler <= 0)
+			{
+				game.register_action(Action::spawn(it->pos, 1));
+			}
 		}
 	}
-	if (onLine.size() == 1)
+	vector<int> units;
+	vector<int> targets;
+	vector<int> assigned;
+	for (auto it = teritory.my_bots.begin(); it != teritory.my_bots.end(); it++)
+	{
+		for (int u = 0; u < it->units; u++)
+			units.push_back(game.grid.index(it->pos));
+	}
+	for (int i = notMine.first(); i != -1; i = notMine.next(i))
+		targets.push_back(i);
+	game.assignment.solve(game.grid, units, targets, assigned);
+	for (size_t i = 0; i < units.size(); i++)
+	{
+		if (assigned[i] == -1)
+			continue;
+		Position from = game.grid.position(units[i]);
+		game.register_action(Action::move(from, game.grid.position(targets[assigned[i]]), 1));
+	}
+}
+
+// Owned empty cells an opponent unit may reach within two turns get a unit
+// first, so they aren't taken without a fight. Cells next to opponent
+// units are already handled by the defensive builds.
+void anticipate_threats(Game &game)
+{
+	CellSet defendable = game.planes().defendable();
+	for (int i = defendable.first(); i != -1; i = defendable.next(i))
+	{
+		if (game.my_matter < 10)
+			break;
+		if (game.threats.within(i, THREAT_SPAWN_TURNS) >= THREAT_SPAWN)
+			game.register_action(Action::spawn(game.grid.position(i), 1));
+	}
+}
+
+// Candidates spare at least 3 neighbours and overlap no recycler; the
+// best yields are built first while matter lasts
+void build_recyclers(Game &game)
+{
+	Grid &grid = game.grid;
+	RecyclerMap &map = game.recyclers();
+	int candidates[MAX_CASES];
+	int count = 0;
+	for (int i = 0; i < grid.size; i++)
+	{
+		if (grid.owner[i] == PLAYER_ME && grid.scrap[i] >= 3 && !(grid.flags[i] & CASE_RECYCLER) && grid.units[i] == 0 && map.overlap[i] == 0 && map.spared[i] >= 3)
+			candidates[count++] = i;
+	}
+	// Insertion sort keeps board order between equal yields
+	for (int i = 1; i < count; i++)
+	{
+		int candidate = candidates[i];
+		int j = i;
+		for (; j > 0 && map.yield[candidates[j - 1]] < map.yield[candidate]; j--)
+			candidates[j] = candidates[j - 1];
+		candidates[j] = candidate;
+	}
+	CellSet blocked;
+	for (int c = 0; c < count; c++)
 	{
-		return *onLine.front();
+		if (game.my_matter < 20)
+			break;
+		if (blocked.test(candidates[c]))
+			continue;
+		if (!game.register_action(Action::build(grid.position(candidates[c]))))
+			break;
+		int around[4];
+		int neighbours = DistanceField::neighbours(grid, candidates[c], around);
+		for (int n = 0; n < neighbours; n++)
+			blocked.set(around[n]);
 	}
+}
+
+/*=======================================================================
+||                                                                     ||
+||                              Strategy                               ||
+||                                                                     ||
+=======================================================================*/
+
+class Strategy
+{
+public:
+	int turn;
+	bool attack;
+	int xDir;
+	int yDir;
+	Position spawn;
+	Position middle;
+	Strategy();
+	void init(Game &game);
+	void play_turn(Game &game);
+	void first_turn(Game &game);
+	void next_turn(Game &game);
+};
+
+Strategy::Strategy()
+{
+	turn = 0;
+	attack = false;
+	xDir = 1;
+	yDir = 1;
+}
+
+void Strategy::play_turn(Game &game)
+{
+	if (++turn == 1)
+		first_turn(game);
 	else
+		next_turn(game);
+}
+
+void Strategy::first_turn(Game &game)
+{
+	init(game);
+	vector<Teritory> teritories = game.get_teritories();
+	expand(game, teritories[0], spawn, middle, xDir);
+}
+
+// Orientation of the map, taken from the first cell I own
+void Strategy::init(Game &game)
+{
+	Position myBase;
+	for (int i = 0; i < game.grid.size; i++)
+	{
+		if (game.grid.owner[i] == PLAYER_ME)
+		{
+			myBase = game.grid.position(i);
+			break;
+		}
+	}
+
+	xDir = myBase.x > game.width / 2 ? -1 : 1;
+	yDir = myBase.y > game.height / 2 ? -1 : 1;
+	spawn = Position(myBase.x, myBase.y);
+	middle = Position(game.width / 2 - xDir, game.height / 2 - yDir);
+}
+
+void Strategy::next_turn(Game &game)
+{
+	for (auto it = game.opp_bots.begin(); it != game.opp_bots.end(); it++)
+	{
+		if (game.my_matter < 10)
+			break;
+		Position target = Position(it->pos.x - xDir, it->pos.y);
+		if (is_available_for_defend(game, target))
+		{
+			game.register_action(Action::build(target));
+			attack = true;
+		}
+		if (game.my_matter < 10)
+			break;
+		target = Position(it->pos.x + xDir, it->pos.y);
+		if (is_available_for_defend(game, target))
+		{
+			game.register_action(Action::build(target));
+			attack = true;
+		}
+	}
+
+	for (auto it = game.opp_bots.begin(); it != game.opp_bots.end(); it++)
+	{
+		if (game.my_matter < 10)
+			break;
+		Position target = Position(it->pos.x, it->pos.y + 1);
+		if (is_available_for_defend(game, target))
+		{
+			game.register_action(Action::build(target));
+			attack = true;
+		}
+		if (game.my_matter < 10)
+			break;
+		target = Position(it->pos.x, it->pos.y - 1);
+		if (is_available_for_defend(game, target))
+		{
+			game.register_action(Action::build(target));
+			attack = true;
+		}
+	}
+
+#if THREAT_SPAWNS
+	anticipate_threats(game);
+#endif
+	vector<Teritory> teritories = game.get_teritories();
+	if (!isAllIsolate(game) && !attack)
+	{
+		build_recyclers(game);
+	}
+	for (auto it = teritories.begin(); it != teritories.end(); it++)
 	{
-		int betterX = onLine.front()->pos.x;
-		Bot &betterBot = *onLine.front();
-		for (auto it = onLine.begin(); it != onLine.end(); it++)
+		if (!it->isIsolateWithCase())
 		{
-			if (xDir == 1)
+			bool found = false;
+			for (auto it2 = it->my_bots.begin(); it2 != it->my_bots.end(); it2++)
 			{
-				if ((*it)->pos.x > betterX)
+				for (int w = it2->pos.x; w >= 0 && w < game.width; w += xDir)
 				{
-					betterX = (*it)->pos.x;
-					betterBot = **it;
+					if (game.get_case(w, it2->pos.y).scrap_amount > 0)
+					{
+						found = true;
+						break;
+					}
 				}
 			}
+			if (!found)
+				expand(game, *it, spawn, middle, xDir * -1);
 			else
+				expand(game, *it, spawn, middle, xDir);
+		}
+		else if (it->owner == PLAYER_ME)
+		{
+			splatoon(game, *it);
+		}
+		else if (it->isIsolateWithCase() && it->owner == PLAYER_OPPONENT)
+		{
+			for (auto it2 = it->cases.begin(); it2 != it->cases.end(); it2++)
 			{
-				if ((*it)->pos.x < betterX)
+				if (game.my_matter < 10)
+					break;
+				bool spawn = game.my_bots.size() == 0;
+				if (it2->owner == PLAYER_ME && it2->scrap_amount > 0 && it2->recycler <= 0)
 				{
-					betterX = (*it)->pos.x;
-					betterBot = **it;
+					if (spawn)
+						game.register_action(Action::spawn(it2->pos, 1));
+					else
+						game.register_action(Action::build(it2->pos));
 				}
 			}
 		}
-		return betterBot;
 	}
 }
 
-Position compute_target(Game &game, Position from, Position spawn, Position middle)
+/*=======================================================================
+||                                                                     ||
+||                               Planner                               ||
+||                                                                     ||
+=======================================================================*/
+#define FIRST_TURN_BUDGET_MS 1000
+#define TURN_BUDGET_MS 50
+#ifndef TURN_SAFETY_MARGIN_MS
+#define TURN_SAFETY_MARGIN_MS 10
+#endif
+
+// Time left in the current turn, started once the inputs are read
+class TurnClock
 {
-	Position offset = middle - spawn;
-	Position to = from + offset;
-	if (to.x < 0)
+public:
+	chrono::steady_clock::time_point started;
+	long long budget_us;
+	TurnClock()
 	{
-		to.x = 0;
+		start(TURN_BUDGET_MS);
 	}
-	else if (to.x >= game.width)
+	void start(int budget_ms)
 	{
-		to.x = game.width - 1;
+		started = chrono::steady_clock::now();
+		budget_us = budget_ms * 1000LL;
 	}
-	if (to.y < 0)
+	long long elapsed_us() const
 	{
-		to.y = 0;
+		return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started).count();
 	}
-	else if (to.y >= game.height)
+	bool expired(int margin_ms) const
 	{
-		to.y = game.height - 1;
+		return elapsed_us() >= budget_us - margin_ms * 1000LL;
 	}
-	return to;
-}
+};
 
-int count_bot_from(Game &game, Position from, Teritory &teritory, int yDir)
+#define PLANNER_BEAM_WIDTH 8
+#define PLANNER_ROLLOUT_TURNS 3
+#define PLANNER_MAX_SLOTS 64
+#define PLANNER_MAX_OPTIONS 6
+// Search threads; the arena runs one, `main play <threads>` overrides it
+#ifndef PLANNER_THREADS
+#define PLANNER_THREADS 1
+#endif
+
+#ifndef TRANSPOSITION_BITS
+#define TRANSPOSITION_BITS 16
+#endif
+#define TRANSPOSITION_SIZE (1 << TRANSPOSITION_BITS)
+
+// Fixed-size, always-replace table of rollout scores by position hash,
+// shared by every planner and search thread without locks. A slot keeps
+// key ^ data next to data, so a slot torn by two writers reads as a miss.
+class TranspositionTable
 {
-	int count = 0;
-	for (int h = from.y + yDir; h >= 0 && h < game.height; h += yDir)
+public:
+	atomic<uint64_t> keys[TRANSPOSITION_SIZE];
+	atomic<uint64_t> data[TRANSPOSITION_SIZE];
+	atomic<long long> probes;
+	atomic<long long> hits;
+	void clear()
+	{
+		for (int i = 0; i < TRANSPOSITION_SIZE; i++)
+		{
+			keys[i].store(0, memory_order_relaxed);
+			data[i].store(0, memory_order_relaxed);
+		}
+		probes = 0;
+		hits = 0;
+	}
+	bool probe(uint64_t key, int &score)
+	{
+		probes.fetch_add(1, memory_order_relaxed);
+		int slot = key & (TRANSPOSITION_SIZE - 1);
+		uint64_t value = data[slot].load(memory_order_relaxed);
+		if ((keys[slot].load(memory_order_relaxed) ^ value) != key)
+			return false;
+		hits.fetch_add(1, memory_order_relaxed);
+		score = (int32_t)(uint32_t)value;
+		return true;
+	}
+	void store(uint64_t key, int score)
 	{
-		count += count_bot_on_line(teritory, h);
+		int slot = key & (TRANSPOSITION_SIZE - 1);
+		uint64_t value = (uint32_t)score;
+		keys[slot].store(key ^ value, memory_order_relaxed);
+		data[slot].store(value, memory_order_relaxed);
 	}
-	return count;
-}
+};
+
+TranspositionTable transpositions;
 
-int count_line(Game &game, Position from, int yDir)
+// One decision of the turn. Option 0 is what the strategy chose; an
+// action without amount stands for doing nothing.
+class PlanSlot
 {
-	int count = 0;
-	for (int h = from.y + yDir; h >= 0 && h < game.height; h += yDir)
+public:
+	Action options[PLANNER_MAX_OPTIONS];
+	int count;
+	void add(Action action)
 	{
-		count++;
+		if (count < PLANNER_MAX_OPTIONS)
+			options[count++] = action;
 	}
-	return count;
-}
+};
 
-bool is_needed_line(Game &game, Position pos, int xDir)
+class PlanNode
 {
-	while (pos.x >= 0 && pos.x < game.width)
-	{
-		if ((game.get_case(pos.x, pos.y).scrap_amount <= 0 || game.get_case(pos.x, pos.y).recycler >= 0))
-		{
-			return (xDir == 1 && pos.x >= game.width / 2) || (xDir == -1 && pos.x <= game.width / 2);
-		}
-		if (game.get_case(pos.x, pos.y).owner == PLAYER_ME)
-		{
-			return false;
-		}
-		pos.x += xDir;
-	}
-	return true;
-}
+public:
+	uint8_t choice[PLANNER_MAX_SLOTS];
+	int score;
+};
 
-bool is_walkable(Game &game, Position pos)
+// Anytime refinement of the strategy's turn: a beam search that settles
+// one slot at a time, scoring each partial plan (remaining slots left at
+// the strategy's choice) by rolling a BoardState clone forward. The best
+// plan so far is complete at every level, so the search can stop at the
+// deadline and the action manager always holds a valid answer.
+//
+// With several threads, the rollouts of a level are shared out through an
+// atomic cursor. Each child is scored by exactly one worker, so workers
+// only ever touch atomics and their own nodes. Children left unscored at
+// the deadline are ranked last, and the level merges what was finished.
+class Planner
 {
-	if (pos.x < 0 || pos.x >= game.width || pos.y < 0 || pos.y >= game.height)
-		return false;
-	if (game.get_case(pos).scrap_amount <= 0 || game.get_case(pos).recycler > 0)
-		return false;
-	return true;
-}
+public:
+	int margin_ms;
+	int threads;
+	atomic<int> evaluations;
+	PlanSlot slots[PLANNER_MAX_SLOTS];
+	int slot_count;
+	// Strategy actions past the last slot, replayed as they are
+	ActionBuffer unslotted;
+	PlanNode beam[PLANNER_BEAM_WIDTH];
+	PlanNode children[PLANNER_BEAM_WIDTH * PLANNER_MAX_OPTIONS];
+	Planner(int margin_ms = TURN_SAFETY_MARGIN_MS, int threads = PLANNER_THREADS)
+	{
+		this->margin_ms = margin_ms;
+		this->threads = threads;
+		evaluations = 0;
+		slot_count = 0;
+	}
+	void plan(Game &game, Strategy &strategy, TurnClock &clock);
+	void build_slots(BoardState &root, ActionBuffer &baseline);
+	void materialize(PlanNode &node, ActionBuffer &actions);
+	int rollout(BoardState &root, ActionBuffer &actions);
+	PlanNode search(BoardState &root, TurnClock &clock);
+
+private:
+	// The level being scored, published to the workers by bumping job_level.
+	// The next level is only set up once every worker reported idle.
+	atomic<int> job_level;
+	atomic<int> job_cursor;
+	atomic<int> job_done;
+	atomic<int> job_idle;
+	int job_pending[PLANNER_BEAM_WIDTH * PLANNER_MAX_OPTIONS];
+	int job_count;
+	BoardState *job_root;
+	TurnClock *job_clock;
+	void work(ActionBuffer &actions);
+	void worker();
+};
 
-bool is_line_covered(Game &game, Position from)
+// Every stack of `player` walks one step toward its closest cell it
+// doesn't own yet; the policy both sides follow after the planned turn
+template <class Dims>
+void greedy_moves(Grid &grid, Player player, ActionBuffer &actions, Dims dims)
 {
-	if (from.y < 0 || from.y >= game.height)
-		return true;
-	bool covered = false;
-	for (int w = from.x; w >= 0 && w < game.width; w--)
+	CellSet targets;
+	for (int i = 0; i < dims.size; i++)
 	{
-		if (game.get_case(w, from.y).scrap_amount <= 0)
-			break;
-		if (game.get_case(w, from.y).owner == PLAYER_ME)
+		if (grid.owner[i] != player && grid.is_walkable(i))
+			targets.set(i);
+	}
+	DistanceField field;
+	field.compute(grid, targets, dims);
+	for (int i = 0; i < dims.size; i++)
+	{
+		if (grid.owner[i] != player || grid.units[i] == 0 || field.distance[i] <= 0)
+			continue;
+		int around[4];
+		int count = DistanceField::neighbours(dims, i, around);
+		for (int n = 0; n < count; n++)
 		{
-			covered = true;
-			break;
+			if (field.distance[around[n]] == field.distance[i] - 1 && grid.is_walkable(around[n]))
+			{
+				actions.push_back(Action::move(grid.position(i), grid.position(around[n]), grid.units[i]));
+				break;
+			}
 		}
 	}
-	if (covered)
-		return true;
-	for (int w = from.x; w >= 0 && w < game.width; w++)
+}
+
+void Planner::plan(Game &game, Strategy &strategy, TurnClock &clock)
+{
+	TraceScope scope(PHASE_PLANNER);
+	BoardState root(game.grid, game.opp_matter, game.my_matter);
+	strategy.play_turn(game);
+	build_slots(root, game.action_manager.actions);
+	PlanNode best = search(root, clock);
+	for (int s = 0; s < slot_count; s++)
 	{
-		if (game.get_case(w, from.y).scrap_amount <= 0)
-			break;
-		if (game.get_case(w, from.y).owner == PLAYER_ME)
+		if (best.choice[s] != 0)
 		{
-			covered = true;
+			materialize(best, game.action_manager.actions);
 			break;
 		}
 	}
-	return covered;
 }
 
-void expand(Game &game, Teritory &teritory, Position spawn, Position middle, int xDir)
+// A slot per strategy action, then one per idle stack. Moves may stay or
+// go to any neighbour of their origin and spawns may shift to an owned
+// neighbour; builds and the spawn budget are left to the strategy, which
+// plays longer-term than the rollouts can see. Strategy actions past
+// PLANNER_MAX_SLOTS are kept unchanged. Cells the strategy builds on this
+// turn hold a recycler by the time units move or spawn, so no option
+// targets them.
+void Planner::build_slots(BoardState &root, ActionBuffer &baseline)
 {
-	static int dir = -1;
-	dir *= -1;
-	vector<Position> directors;
-	vector<Case> front_line;
-	for (int h = (dir == 1 ? 0 : game.height - 1); h < game.height && h >= 0; h += dir)
+	Grid &grid = root.grid;
+	CellSet moving;
+	CellSet building;
+	slot_count = 0;
+	unslotted.clear();
+	for (auto it = baseline.begin(); it != baseline.end(); it++)
+	{
+		if (it->type == ACTION_BUILD && grid.is_in(it->from()))
+			building.set(grid.index(it->from()));
+	}
+	for (auto it = baseline.begin(); it != baseline.end(); it++)
 	{
-		for (int w = (xDir == 1 ? game.width - 1 : 0); w >= 0 && w < game.width; w -= xDir)
+		if (slot_count == PLANNER_MAX_SLOTS)
 		{
-			if (game.get_case(w, h).owner == PLAYER_ME && game.get_case(w, h).recycler <= 0)
+			unslotted.push_back(*it);
+			continue;
+		}
+		PlanSlot &slot = slots[slot_count++];
+		slot.count = 0;
+		slot.add(*it);
+		if (!grid.is_in(it->from()))
+			continue;
+		int from = grid.index(it->from());
+		int around[4];
+		int count = DistanceField::neighbours(grid, from, around);
+		if (it->type == ACTION_MOVE)
+		{
+			moving.set(from);
+			slot.add(Action::move(it->from(), it->from(), 0));
+			for (int n = 0; n < count; n++)
 			{
-				if (is_walkable(game, Position(w - xDir, h)) && game.get_case(w - xDir, h).owner != PLAYER_OPPONENT)
-				{
-					front_line.push_back(game.get_case(w, h));
-					break;
-				}
+				if (grid.is_walkable(around[n]) && !building.test(around[n]) && !(grid.position(around[n]) == it->to()))
+					slot.add(Action::move(it->from(), grid.position(around[n]), it->amount));
 			}
 		}
-		if (is_bot_on_line(teritory, h))
+		else if (it->type == ACTION_SPAWN)
 		{
-			Bot &director = get_most_advanced_on_line(teritory, xDir, h);
-			Position target = Position(director.pos.x + xDir, h);
-			if (is_walkable(game, Position(director.pos.x - xDir, h)) && game.get_case(Position(director.pos.x - xDir, h)).owner != PLAYER_OPPONENT)
-				directors.push_back(director.pos);
-			if (!is_walkable(game, target) || game.get_case(target).owner == PLAYER_ME)
-			{
-				target = Position(director.pos.x, h + (director.pos.y < middle.y ? 1 : -1));
-				if (!is_walkable(game, target) || game.get_case(target).owner == PLAYER_ME)
-				{
-					target = Position(director.pos.x, h + (director.pos.y < middle.y ? -1 : 1));
-					if (!is_walkable(game, target) || game.get_case(target).owner == PLAYER_ME)
-					{
-						vector<Case> notMine;
-						for (auto it = teritory.cases.begin(); it != teritory.cases.end(); it++)
-						{
-							if (it->owner != PLAYER_ME)
-								notMine.push_back(*it);
-						}
-						Position dest = get_nearest(director.pos, notMine);
-						game.register_action(new ActionMove(director.pos, dest, 1));
-					}
-				}
-			}
-			game.register_action(new ActionMove(director.pos, target, 1));
-			director.pos = target;
-			for (int w = director.pos.x; w >= 0 && w < game.width; w -= xDir)
+			for (int n = 0; n < count; n++)
 			{
-				int usable = game.get_case(w, h).owner == PLAYER_ME ? game.get_case(w, h).units : 0;
-				Position origin = Position(w, h);
-				if (w == director.from.x)
-				{
-					usable -= 1;
-				}
-				if (usable > 0)
-				{
-					target = Position(origin.x, h + dir);
-					if (!is_walkable(game, target) || is_line_covered(game, target))
-					{
-						target = Position(origin.x, h - dir);
-						if (!is_walkable(game, target) || is_line_covered(game, target))
-						{
-							target = Position(origin.x, h + 1);
-							if (!is_walkable(game, target) || game.get_case(target).owner == PLAYER_ME)
-							{
-								target = Position(origin.x, h - 1);
-								if (!is_walkable(game, target) || game.get_case(target).owner == PLAYER_ME)
-								{
-									vector<Case> notMine;
-									for (auto it = teritory.cases.begin(); it != teritory.cases.end(); it++)
-									{
-										if (it->owner != PLAYER_ME)
-											notMine.push_back(*it);
-									}
-									target = get_nearest(origin, notMine);
-								}
-							}
-						}
-					}
-					game.register_action(new ActionMove(origin, target, usable));
-				}
+				if (grid.is_walkable(around[n]) && grid.owner[around[n]] == PLAYER_ME && !building.test(around[n]))
+					slot.add(Action::spawn(grid.position(around[n]), it->amount));
 			}
 		}
 	}
-	for (auto it = directors.begin(); it != directors.end(); it++)
+	for (int i = 0; i < grid.size && slot_count < PLANNER_MAX_SLOTS; i++)
 	{
-		if (game.my_matter < 10)
-			break;
-		Position target = Position(it->x, it->y + dir);
-		if (is_walkable(game, target) && !is_line_covered(game, target))
+		if (grid.owner[i] != PLAYER_ME || grid.units[i] == 0 || moving.test(i))
+			continue;
+		PlanSlot &slot = slots[slot_count++];
+		slot.count = 0;
+		slot.add(Action::move(grid.position(i), grid.position(i), 0));
+		int around[4];
+		int count = DistanceField::neighbours(grid, i, around);
+		for (int n = 0; n < count; n++)
 		{
-			game.register_action(new ActionSpawn(*it, 1));
-			break;
+			if (grid.is_walkable(around[n]) && !building.test(around[n]))
+				slot.add(Action::move(grid.position(i), grid.position(around[n]), grid.units[i]));
 		}
-		target = Position(it->x, it->y - dir);
-		if (is_walkable(game, target) && !is_line_covered(game, target))
-			game.register_action(new ActionSpawn(*it, 1));
 	}
-	for (auto it = teritory.my_bots.begin(); it != teritory.my_bots.end(); it++)
+}
+
+void Planner::materialize(PlanNode &node, ActionBuffer &actions)
+{
+	actions.clear();
+	for (int s = 0; s < slot_count; s++)
 	{
-		if (game.my_matter < 10)
-			break;
-		for (auto it2 = teritory.opp_bots.begin(); it2 != teritory.opp_bots.end(); it2++)
-		{
-			if (it->from.distance(it2->pos) <= 1)
-			{
-				game.register_action(new ActionSpawn(it->from, 1));
-				break;
-			}
-		}
+		Action &action = slots[s].options[node.choice[s]];
+		if (action.amount > 0 || action.type == ACTION_BUILD)
+			actions.push_back(action);
 	}
-	for (auto it = front_line.begin(); it != front_line.end(); it++)
+	for (auto it = unslotted.begin(); it != unslotted.end(); it++)
+		actions.push_back(*it);
+}
+
+// Cells, units and matter ahead of the opponent after the planned turn
+// and a few greedy ones
+template <class Dims>
+int rollout_kernel(BoardState &root, ActionBuffer &actions)
+{
+	Dims dims(root.grid.width, root.grid.height);
+	BoardState state = root;
+	ActionBuffer mine;
+	ActionBuffer theirs;
+	greedy_moves(state.grid, PLAYER_OPPONENT, theirs, dims);
+	state.step(actions, theirs, dims);
+	// The greedy turns that follow only depend on the board, and matter only
+	// adds to the score, so plans reaching the same board share the rest
+	int matter = state.matter[PLAYER_ME] - state.matter[PLAYER_OPPONENT];
+	uint64_t key = state.grid.hash;
+	int cached;
+	if (transpositions.probe(key, cached))
+		return matter + cached;
+	for (int turn = 1; turn < PLANNER_ROLLOUT_TURNS; turn++)
+	{
+		mine.clear();
+		theirs.clear();
+		greedy_moves(state.grid, PLAYER_ME, mine, dims);
+		greedy_moves(state.grid, PLAYER_OPPONENT, theirs, dims);
+		state.step(mine, theirs, dims);
+	}
+	int score = state.matter[PLAYER_ME] - state.matter[PLAYER_OPPONENT];
+	for (int i = 0; i < dims.size; i++)
+	{
+		if (state.grid.owner[i] == PLAYER_ME)
+			score += 10 + 3 * state.grid.units[i];
+		else if (state.grid.owner[i] == PLAYER_OPPONENT)
+			score -= 10 + 3 * state.grid.units[i];
+	}
+	transpositions.store(key, score - matter);
+	return score;
+}
+
+typedef int (*RolloutKernel)(BoardState &root, ActionBuffer &actions);
+
+// Rollout specialised for the map size, one instantiation per size the
+// referee can send
+RolloutKernel select_rollout(int width, int height)
+{
+	if (width != height * 2)
+		return rollout_kernel<RuntimeDims>;
+	switch (height)
+	{
+	case 6:
+		return rollout_kernel<FixedDims<12, 6> >;
+	case 7:
+		return rollout_kernel<FixedDims<14, 7> >;
+	case 8:
+		return rollout_kernel<FixedDims<16, 8> >;
+	case 9:
+		return rollout_kernel<FixedDims<18, 9> >;
+	case 10:
+		return rollout_kernel<FixedDims<20, 10> >;
+	case 11:
+		return rollout_kernel<FixedDims<22, 11> >;
+	case 12:
+		return rollout_kernel<FixedDims<24, 12> >;
+	}
+	return rollout_kernel<RuntimeDims>;
+}
+
+int Planner::rollout(BoardState &root, ActionBuffer &actions)
+{
+	evaluations++;
+	return select_rollout(root.grid.width, root.grid.height)(root, actions);
+}
+
+// Scores pending children of the current level until none is left
+void Planner::work(ActionBuffer &actions)
+{
+	for (int c = job_cursor++; c < job_count; c = job_cursor++)
 	{
-		if (game.my_matter < 10)
-			break;
-		if (it->units == 0)
+		PlanNode &child = children[job_pending[c]];
+		if (job_clock->expired(margin_ms))
+			child.score = INT32_MIN;
+		else
 		{
-			game.register_action(new ActionSpawn(it->pos, 1));
+			materialize(child, actions);
+			child.score = rollout(*job_root, actions);
 		}
+		job_done++;
 	}
 }
 
-void splatoon(Game &game, Teritory &teritory)
+void Planner::worker()
 {
-	vector<Case> notMine;
-	for (auto it = teritory.cases.begin(); it != teritory.cases.end(); it++)
+	ActionBuffer actions;
+	int seen = 0;
+	while (true)
 	{
-		if (it->owner != PLAYER_ME)
+		int level = job_level.load();
+		if (level < 0)
+		{
+			trace_flush();
+			return;
+		}
+		if (level == seen)
 		{
-			notMine.push_back(*it);
+			this_thread::yield();
+			continue;
 		}
+		seen = level;
+		work(actions);
+		job_idle++;
 	}
-	if (teritory.my_bots.size() == 0)
-	{
-		for (auto it = teritory.cases.begin(); it != teritory.cases.end(); it++)
+}
+
+PlanNode Planner::search(BoardState &root, TurnClock &clock)
+{
+	ActionBuffer actions;
+	int width = 1;
+	fill(beam[0].choice, beam[0].choice + PLANNER_MAX_SLOTS, 0);
+	materialize(beam[0], actions);
+	beam[0].score = rollout(root, actions);
+	PlanNode best = beam[0];
+	job_root = &root;
+	job_clock = &clock;
+	job_level = 0;
+	vector<thread> workers;
+	for (int t = 1; t < threads; t++)
+		workers.push_back(thread(&Planner::worker, this));
+	for (int s = 0; s < slot_count && !clock.expired(margin_ms); s++)
+	{
+		if (slots[s].count <= 1)
+			continue;
+		int count = 0;
+		job_count = 0;
+		for (int b = 0; b < width; b++)
 		{
-			if (it->owner == PLAYER_ME && it->scrap_amount > 0 && it->recycler <= 0)
+			for (int o = 0; o < slots[s].count; o++)
 			{
-				game.register_action(new ActionSpawn(it->pos, 1));
+				PlanNode &child = children[count];
+				child = beam[b];
+				child.choice[s] = o;
+				if (o != 0)
+					job_pending[job_count++] = count;
+				count++;
 			}
 		}
-	}
-	vector<Bot> available = teritory.my_bots;
-	for (auto it = notMine.begin(); it != notMine.end(); it++)
-	{
-		Position bot = get_nearest(it->pos, available);
-		game.register_action(new ActionMove(bot, it->pos, game.get_case(bot).units));
-		std::remove_if(available.begin(), available.end(),
-					   [bot](Bot &test)
-					   {
-						   return test.pos == bot;
-					   });
-	}
+		job_cursor = 0;
+		job_done = 0;
+		job_idle = 0;
+		job_level++;
+		work(actions);
+		while (job_done < job_count || job_idle < threads - 1)
+			this_thread::yield();
+		// Ties keep the earlier node, so the strategy's choice wins them
+		stable_sort(children, children + count,
+					[](const PlanNode &a, const PlanNode &b)
+					{
+						return a.score > b.score;
+					});
+		width = min(count, PLANNER_BEAM_WIDTH);
+		copy(children, children + width, beam);
+		if (beam[0].score > best.score)
+			best = beam[0];
+	}
+	job_level = -1;
+	for (auto it = workers.begin(); it != workers.end(); it++)
+		it->join();
+	return best;
 }
 
 /*=======================================================================
 ||                                                                     ||
-||                           Main Function                             ||
+||                               Replays                               ||
 ||                                                                     ||
 =======================================================================*/
+// A replay file is a header followed by one frame per turn and player:
+// what that player saw (already from its point of view) and the actions it
+// emitted. Cells are stored as the Grid arrays of the map, so a frame loads
+// back with a few memcpy and no parsing. The board part of a frame has a
+// fixed size and is followed by exactly action_count actions.
+#define REPLAY_MAGIC "KOTG"
+#define REPLAY_VERSION 3
+#define REPLAY_FRAME_HEADER 16
 
-int main()
+class ReplayHeader
 {
-	int width;
-	int height;
-	Mode mode = EXPAND;
-	cin >> width >> height;
-	cin.ignore();
-	if (INPUT_DEBUG)
-	{
-		cerr << "Readed initialization inputs" << endl;
-	}
+public:
+	char magic[4];
+	uint16_t version;
+	uint8_t width;
+	uint8_t height;
+	uint32_t board_size;
+};
 
-	Game game(width, height);
+class ReplayFrameHeader
+{
+public:
+	uint16_t turn;
+	uint16_t action_count;
+	uint8_t viewer;
+	uint8_t reserved[3];
+	int32_t my_matter;
+	int32_t opp_matter;
+};
 
-	game.read_inputs();
+// Frame header and cells, the part every frame of a map has
+int replay_board_size(int width, int height)
+{
+	return REPLAY_FRAME_HEADER + 5 * width * height;
+}
 
-	Position myBase;
-	for (auto it = game.cases.begin(); it != game.cases.end(); it++)
+// Frames are built in two steps, since the board has to be captured before
+// the strategy plays on it and the actions are only known afterwards
+class ReplayWriter
+{
+public:
+	ReplayWriter()
 	{
-		if (it->owner == PLAYER_ME)
-		{
-			myBase = it->pos;
-			break;
-		}
+		file = NULL;
+	}
+	~ReplayWriter()
+	{
+		close();
+	}
+	bool open(string path, int width, int height)
+	{
+		file = fopen(path.c_str(), "wb");
+		if (file == NULL)
+			return false;
+		ReplayHeader header;
+		memcpy(header.magic, REPLAY_MAGIC, 4);
+		header.version = REPLAY_VERSION;
+		header.width = width;
+		header.height = height;
+		header.board_size = replay_board_size(width, height);
+		board_size = header.board_size;
+		fwrite(&header, sizeof(header), 1, file);
+		return true;
+	}
+	bool is_open()
+	{
+		return file != NULL;
+	}
+	void close()
+	{
+		if (file != NULL)
+			fclose(file);
+		file = NULL;
+	}
+	void begin(Game &view, int turn, Player viewer)
+	{
+		ReplayFrameHeader header;
+		header.turn = turn;
+		header.viewer = viewer;
+		header.action_count = 0;
+		fill(header.reserved, header.reserved + 3, 0);
+		header.my_matter = view.my_matter;
+		header.opp_matter = view.opp_matter;
+		memcpy(board, &header, sizeof(header));
+		Grid &grid = view.grid;
+		char *cells = board + REPLAY_FRAME_HEADER;
+		memcpy(cells, grid.scrap, grid.size);
+		memcpy(cells + grid.size, grid.owner, grid.size);
+		memcpy(cells + 2 * grid.size, grid.units, 2 * grid.size);
+		memcpy(cells + 4 * grid.size, grid.flags, grid.size);
+	}
+	// Flushed every frame, so a match killed by the referee keeps its turns
+	void end(ActionBuffer &emitted)
+	{
+		uint16_t count = emitted.size;
+		memcpy(board + offsetof(ReplayFrameHeader, action_count), &count, sizeof(count));
+		fwrite(board, board_size, 1, file);
+		fwrite(emitted.begin(), sizeof(Action), count, file);
+		fflush(file);
 	}
 
-	int xDir = myBase.x > game.width / 2 ? -1 : 1;
-	int yDir = myBase.y > game.height / 2 ? -1 : 1;
-	Position spawn = Position(myBase.x, myBase.y);
-	Position middle = Position(game.width / 2 - xDir, game.height / 2 - yDir);
-
-	vector<Teritory> teritories = game.get_teritories();
-	expand(game, teritories[0], spawn, middle, xDir);
-
-	game.execute_actions();
+private:
+	FILE *file;
+	int board_size;
+	char board[REPLAY_FRAME_HEADER + 5 * MAX_CASES];
+};
 
-	int turn = 1;
-	bool attack = false;
-	while (++turn)
-	{
-		game.read_inputs();
+/*=======================================================================
+||                                                                     ||
+||                           Main Function                             ||
+||                                                                     ||
+=======================================================================*/
 
-		for (auto it = game.opp_bots.begin(); it != game.opp_bots.end(); it++)
-		{
-			if (game.my_matter < 10)
-				break;
-			Position target = Position(it->pos.x - xDir, it->pos.y);
-			if (is_available_for_defend(game.get_case(target)))
-			{
-				game.register_action(new ActionBuildRecycler(target));
-				attack = true;
-			}
-			if (game.my_matter < 10)
-				break;
-			target = Position(it->pos.x + xDir, it->pos.y);
-			if (is_available_for_defend(game.get_case(target)))
-			{
-				game.register_action(new ActionBuildRecycler(target));
-				attack = true;
-			}
-		}
+// The offline tools (tools/tools.cpp) include this file with BOT_TOOLS
+// defined and bring their own main
+#ifndef BOT_TOOLS
+int main(int argc, char **argv)
+{
+	trace_configure(getenv("BOT_TRACE"));
 
-		for (auto it = game.opp_bots.begin(); it != game.opp_bots.end(); it++)
-		{
-			if (game.my_matter < 10)
-				break;
-			Position target = Position(it->pos.x, it->pos.y + 1);
-			if (is_available_for_defend(game.get_case(target)))
-			{
-				game.register_action(new ActionBuildRecycler(target));
-				attack = true;
-			}
-			if (game.my_matter < 10)
-				break;
-			target = Position(it->pos.x, it->pos.y - 1);
-			if (is_available_for_defend(game.get_case(target)))
-			{
-				game.register_action(new ActionBuildRecycler(target));
-				attack = true;
-			}
-		}
+	// Usage: main [play [threads]]
+	// BOT_REPLAY=<file> records every turn for tools replay/regress
+	int threads = argc > 2 && string(argv[1]) == "play" ? atoi(argv[2]) : PLANNER_THREADS;
+	InputReader input(0);
+	int width = input.next_int();
+	int height = input.next_int();
+	if (tracing(TRACE_INPUT))
+		trace(TRACE_INPUT, "map size", width, height);
 
-		vector<Teritory> teritories = game.get_teritories();
-		if (!isAllIsolate(game) && !attack)
-		{
-			for (auto it = game.cases.begin(); it != game.cases.end(); it++)
-			{
-				if (game.my_matter < 20)
-					break;
-				if (it->owner == PLAYER_ME && it->scrap_amount >= 3 && it->recycler <= 0 && it->units == 0)
-				{
-					int valid = 0;
-					for (auto it2 = game.cases.begin(); it2 != game.cases.end(); it2++)
-					{
-						if (it->pos.distance(it2->pos) == 1)
-						{
-							if ((it2->scrap_amount == 0 || it2->scrap_amount > it->scrap_amount))
-								valid++;
-							if (it2->in_range_of_recycler)
-							{
-								valid = 0;
-								break;
-							}
-						}
-					}
-					if (valid >= 3)
-					{
-						game.register_action(new ActionBuildRecycler(it->pos));
-					}
-				}
-			}
-		}
-		for (auto it = teritories.begin(); it != teritories.end(); it++)
-		{
-			if (!it->isIsolateWithCase())
-			{
-				bool found = false;
-				for (auto it2 = it->my_bots.begin(); it2 != it->my_bots.end(); it2++)
-				{
-					for (int w = it2->pos.x; w >= 0 && w < game.width; w += xDir)
-					{
-						if (game.get_case(w, it2->pos.y).scrap_amount > 0)
-						{
-							found = true;
-							break;
-						}
-					}
-				}
-				if (!found)
-					expand(game, *it, spawn, middle, xDir * -1);
-				else
-					expand(game, *it, spawn, middle, xDir);
-			}
-			else if (it->owner == PLAYER_ME)
-			{
-				splatoon(game, *it);
-			}
-			else if (it->isIsolateWithCase() && it->owner == PLAYER_OPPONENT)
-			{
-				for (auto it2 = it->cases.begin(); it2 != it->cases.end(); it2++)
-				{
-					if (game.my_matter < 10)
-						break;
-					bool spawn = game.my_bots.size() == 0;
-					if (it2->owner == PLAYER_ME && it2->scrap_amount > 0 && it2->recycler <= 0)
-					{
-						if (spawn)
-							game.register_action(new ActionSpawn(it2->pos, 1));
-						else
-							game.register_action(new ActionBuildRecycler(it2->pos));
-					}
-				}
-			}
-		}
+	Game game(width, height);
+	Strategy strategy;
+	Planner planner(TURN_SAFETY_MARGIN_MS, max(threads, 1));
+	TurnClock clock;
+	int turn = 0;
+	ReplayWriter replay;
+	const char *replay_path = getenv("BOT_REPLAY");
+	if (replay_path != NULL && !replay.open(replay_path, width, height))
+		cerr << "Can't record to " << replay_path << endl;
+
+	while (true)
+	{
+		game.read_inputs(input);
+		if (input.eof)
+			break;
+		clock.start(++turn == 1 ? FIRST_TURN_BUDGET_MS : TURN_BUDGET_MS);
+		if (replay.is_open())
+			replay.begin(game, turn, PLAYER_ME);
+		planner.plan(game, strategy, clock);
+		if (replay.is_open())
+			replay.end(game.action_manager.actions);
 		game.execute_actions();
+		trace_flush();
 	}
+	trace_flush();
+	trace_report();
 }
+#endif
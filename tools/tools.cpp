@@ -0,0 +1,1117 @@
+// Offline tools around the bot: self-play, benchmarks, replays and the
+// regression check. The bot itself is main.cpp alone, the file submitted to
+// the arena; it is included here so the tools run the exact same code.
+//
+//   g++ -std=c++17 -O2 -pthread -o bot main.cpp
+//   g++ -std=c++17 -O2 -pthread -o tools tools/tools.cpp
+#define BOT_TOOLS
+#include "../main.cpp"
+#include <new>
+#include <map>
+
+/*=======================================================================
+||                          Allocation counter                         ||
+=======================================================================*/
+// Counts heap allocations per thread so the benchmark can report them
+thread_local long long allocation_count = 0;
+
+__attribute__((noinline)) void *operator new(size_t size)
+{
+	allocation_count++;
+	void *p = malloc(size == 0 ? 1 : size);
+	if (p == NULL)
+		throw bad_alloc();
+	return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+// Memory-maps every .replay file of a directory and numbers their frames
+// one after the other, in file name order. Frames vary in size, so each
+// file keeps the offset of every frame.
+class ReplayReader
+{
+public:
+	class File
+	{
+	public:
+		string path;
+		const char *data;
+		size_t size;
+		int width;
+		int height;
+		int frames;
+		int first;
+		vector<size_t> offsets;
+	};
+	vector<File> files;
+	int frames;
+	ReplayReader()
+	{
+		frames = 0;
+	}
+	~ReplayReader()
+	{
+		for (auto it = files.begin(); it != files.end(); it++)
+			munmap((void *)it->data, it->size);
+	}
+	bool open(string dir)
+	{
+		DIR *handle = opendir(dir.c_str());
+		if (handle == NULL)
+			return false;
+		vector<string> names;
+		for (dirent *entry = readdir(handle); entry != NULL; entry = readdir(handle))
+		{
+			string name = entry->d_name;
+			if (name.size() > 7 && name.compare(name.size() - 7, 7, ".replay") == 0)
+				names.push_back(dir + "/" + name);
+		}
+		closedir(handle);
+		sort(names.begin(), names.end());
+		for (auto it = names.begin(); it != names.end(); it++)
+			map(*it);
+		return true;
+	}
+	File &file_of(int frame)
+	{
+		int low = 0;
+		int high = files.size() - 1;
+		while (low < high)
+		{
+			int middle = (low + high + 1) / 2;
+			if (files[middle].first <= frame)
+				low = middle;
+			else
+				high = middle - 1;
+		}
+		return files[low];
+	}
+	ReplayFrameHeader header(int frame)
+	{
+		ReplayFrameHeader result;
+		memcpy(&result, data(frame), sizeof(result));
+		return result;
+	}
+	// Puts the board of `frame` into `game`, which must have the map's size
+	void load(int frame, Game &game)
+	{
+		const char *start = data(frame);
+		ReplayFrameHeader info = header(frame);
+		Grid &grid = game.grid;
+		const char *cells = start + REPLAY_FRAME_HEADER;
+		game.my_matter = info.my_matter;
+		game.opp_matter = info.opp_matter;
+		memcpy(grid.scrap, cells, grid.size);
+		memcpy(grid.owner, cells + grid.size, grid.size);
+		memcpy(grid.units, cells + 2 * grid.size, 2 * grid.size);
+		memcpy(grid.flags, cells + 4 * grid.size, grid.size);
+		game.refresh_cases();
+#if THREAT_SPAWNS
+		game.threats.observe(grid);
+#endif
+	}
+	void actions(int frame, ActionBuffer &result)
+	{
+		File &file = file_of(frame);
+		const char *start = data(frame) + replay_board_size(file.width, file.height);
+		int count = header(frame).action_count;
+		result.clear();
+		for (int i = 0; i < count; i++)
+		{
+			Action action = Action::build(Position(0, 0));
+			memcpy(&action, start + i * sizeof(Action), sizeof(Action));
+			result.push_back(action);
+		}
+	}
+
+private:
+	const char *data(int frame)
+	{
+		File &file = file_of(frame);
+		return file.data + file.offsets[frame - file.first];
+	}
+	void map(string path)
+	{
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat info;
+		if (fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(ReplayHeader))
+		{
+			::close(fd);
+			return;
+		}
+		void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED)
+			return;
+		ReplayHeader header;
+		memcpy(&header, data, sizeof(header));
+		if (memcmp(header.magic, REPLAY_MAGIC, 4) != 0 || header.version != REPLAY_VERSION || (int)header.board_size != replay_board_size(header.width, header.height))
+		{
+			cerr << "Not a replay: " << path << endl;
+			munmap(data, info.st_size);
+			return;
+		}
+		File file;
+		file.path = path;
+		file.data = (const char *)data;
+		file.size = info.st_size;
+		file.width = header.width;
+		file.height = header.height;
+		// A frame cut short by a killed process ends the file
+		size_t offset = sizeof(ReplayHeader);
+		while (offset + header.board_size <= file.size)
+		{
+			ReplayFrameHeader frame;
+			memcpy(&frame, file.data + offset, sizeof(frame));
+			size_t next = offset + header.board_size + frame.action_count * sizeof(Action);
+			if (next > file.size)
+				break;
+			file.offsets.push_back(offset);
+			offset = next;
+		}
+		file.frames = file.offsets.size();
+		file.first = frames;
+		frames += file.frames;
+		files.push_back(file);
+	}
+};
+
+/*=======================================================================
+||                            Line expansion                           ||
+=======================================================================*/
+// Row-by-row expansion the bot no longer calls, kept as the reference for
+// the "expand(lines)" benchmark phase
+bool is_bot_on_line(Game &game, int height)
+{
+	return game.my_rows.occupied(height);
+}
+
+int count_bot_on_line(Game &game, int height)
+{
+	return game.my_rows.count(height);
+}
+
+Bot &get_most_advanced_on_line(Game &game, int direction, int height)
+{
+	RowIndex &rows = game.my_rows;
+	return game.my_bots[direction == -1 ? rows.first[height] : rows.last[height]];
+}
+
+// Rows holding a unit from `src` to the edge in `direction`, `src` included
+int line_with_bot_in(Game &game, int src, int direction)
+{
+	if (src < 0 || src >= game.height)
+		return 0;
+	if (direction == 1)
+		return game.my_rows.rows_between(src, game.height);
+	return game.my_rows.rows_between(0, src + 1);
+}
+
+bool is_line_util(Game &game, int h, int w, int direction)
+{
+	Position target = Position(w, h);
+	while (target.x >= 0 && target.x < game.width)
+	{
+		Case c = game.get_case(target.x, target.y);
+		if (c.scrap_amount <= 0 || c.recycler > 0)
+		{
+			break;
+		}
+		if (c.owner == PLAYER_OPPONENT)
+		{
+			return true;
+		}
+		target.x += direction;
+	}
+	return (direction == 1 && target.x > game.width / 2) || (direction == -1 && target.x < game.width / 2);
+}
+
+bool is_line_with_no_bot_in(Game &game, int src, int direction, int w)
+{
+	int available = 0;
+	for (int i = src; i >= 0 && i < game.height; i += direction)
+	{
+		if (!is_bot_on_line(game, i) && is_line_util(game, i, w, direction))
+		{
+			available--;
+			if (available <= 0)
+				return true;
+		}
+		else if (i != src)
+		{
+			available += count_bot_on_line(game, i) - 1;
+		}
+	}
+	return false;
+}
+
+void move_top_up(Game &game, int h, Position init_pos, int quantity, int direction)
+{
+	Position dest = Position(0, 0);
+	if (line_with_bot_in(game, h, 1) > line_with_bot_in(game, h, -1))
+	{
+		// More bots on the bottom, better is to go top
+		if (is_line_with_no_bot_in(game, h, -1, init_pos.x))
+		{
+			// There is a needed line in the top, go to top
+			dest = Position(init_pos.x, init_pos.y - 1);
+		}
+		else if (is_line_with_no_bot_in(game, h, 1, init_pos.x))
+		{
+			// There is no needed line in the top, go to bottom
+			dest = Position(init_pos.x, init_pos.y + 1);
+		}
+		else
+		{
+			// There is no needed line in the top, go to bottom
+			dest = Position(init_pos.x + direction, init_pos.y);
+		}
+	}
+	else
+	{
+		// More bots on the top, better is to go bottom
+		if (is_line_with_no_bot_in(game, h, 1, init_pos.x))
+		{
+			// There is a needed line in the bottom, go to bottom
+			dest = Position(init_pos.x, init_pos.y + 1);
+		}
+		else if (is_line_with_no_bot_in(game, h, -1, init_pos.x))
+		{
+			// There is no needed line in the bottom, go to top
+			dest = Position(init_pos.x, init_pos.y - 1);
+		}
+		else
+		{
+			// There is no needed line in the bottom, go to bottom
+			dest = Position(init_pos.x + direction, init_pos.y);
+		}
+	}
+	if (game.get_case(dest).recycler > 0 || game.get_case(dest).scrap_amount <= 0)
+	{
+		dest = Position(init_pos.x - direction, init_pos.y);
+	}
+	game.register_action(Action::move(init_pos, dest, quantity));
+}
+
+void expand(Game &game, int direction, vector<Bot> available)
+{
+	TraceScope scope(PHASE_EXPAND);
+	// Build recycler to block ennemy
+	for (auto it = game.opp_bots.begin(); it != game.opp_bots.end(); it++)
+	{
+		if (game.my_matter < 10)
+			break;
+		Position target = Position(it->pos.x - direction, it->pos.y);
+		if (is_available_for_defend(game, target))
+			game.register_action(Action::build(target));
+	}
+	for (auto it = game.opp_bots.begin(); it != game.opp_bots.end(); it++)
+	{
+		if (game.my_matter < 10)
+			break;
+		Position target = Position(it->pos.x, it->pos.y + 1);
+		if (is_available_for_defend(game, target))
+			game.register_action(Action::build(target));
+		if (game.my_matter < 10)
+			break;
+		target = Position(it->pos.x, it->pos.y - 1);
+		if (is_available_for_defend(game, target))
+			game.register_action(Action::build(target));
+	}
+
+	Position spawner;
+	int dist = 1000;
+	// Parcour lignes
+	for (int h = 0; h < game.height; h++)
+	{
+		if (is_bot_on_line(game, h))
+		{
+			// Set director direction
+			Bot &director = get_most_advanced_on_line(game, direction, h);
+			Position target = Position(director.pos.x + direction, director.pos.y);
+			if (game.get_case(target).scrap_amount > 0 && game.get_case(target).recycler <= 0 && ((game.get_case(target.x + direction, target.y).scrap_amount > 0 && game.get_case(target.x + direction, target.y).recycler <= 0) || (game.get_case(target.x, target.y + 1).scrap_amount > 0 && game.get_case(target.x, target.y + 1).recycler <= 0) || (game.get_case(target.x, target.y - 1).scrap_amount > 0 && game.get_case(target.x, target.y - 1).recycler <= 0)))
+				game.register_action(Action::move(director.pos, target, 1));
+			else
+			{
+				move_top_up(game, h, director.pos, 1, direction);
+			}
+			// Set other bots direction
+			for (int w = director.pos.x; w >= 0 && w < game.width; w -= direction)
+			{
+				int usable = game.get_case(w, h).owner == PLAYER_ME ? game.get_case(w, h).units : 0;
+				if (w == director.pos.x)
+				{
+					usable -= 1;
+				}
+				if (usable > 0)
+				{
+					move_top_up(game, h, Position(w, h), usable, direction);
+				}
+			}
+			// Spawn new bot on the middle
+			int d = abs(line_with_bot_in(game, h, 1) - line_with_bot_in(game, h, -1));
+			if (d < dist)
+			{
+				dist = d;
+				spawner = director.pos;
+			}
+		}
+	}
+	if (dist < 1000)
+	{
+		if (game.my_matter >= 10)
+			game.register_action(Action::spawn(spawner, 1));
+	}
+	for (int i = 0; i < game.grid.size; i++)
+	{
+		if (game.grid.owner[i] != PLAYER_ME)
+			continue;
+		if (game.my_matter < 10)
+			break;
+		Position pos = game.grid.position(i);
+		bool near = is_bot_on_line(game, pos.y);
+		for (auto it2 = available.begin(); it2 != available.end(); it2++)
+		{
+			if (pos.distance(it2->pos) <= 2)
+			{
+				near = true;
+				break;
+			}
+		}
+		if (!near)
+		{
+			game.register_action(Action::spawn(pos, 1));
+		}
+	}
+	if (available.size() == 0)
+	{
+		for (int i = 0; i < game.grid.size; i++)
+		{
+			if (game.grid.owner[i] == PLAYER_ME && game.grid.units[i] > 0)
+			{
+				game.register_action(Action::spawn(game.grid.position(i), 1));
+				break;
+			}
+		}
+	}
+}
+
+/*=======================================================================
+||                                                                     ||
+||                              Self-play                              ||
+||                                                                     ||
+=======================================================================*/
+
+#define SELFPLAY_MAX_TURNS 200
+#define SELFPLAY_STALE_TURNS 20
+
+class MatchResult
+{
+public:
+	int seed;
+	Player winner;
+	int turns;
+	vector<long long> turn_latencies;
+	MatchResult()
+	{
+		seed = 0;
+		winner = PLAYER_NONE;
+		turns = 0;
+	}
+};
+
+// Symmetric map in the spirit of the referee generator: height 6 to 12,
+// width twice the height, scrap mirrored through the center and both
+// bases starting with four units around their spawn cell.
+Game generate_map(int seed)
+{
+	mt19937 rng(seed);
+	int height = 6 + rng() % 7;
+	int width = height * 2;
+	Game game(width, height);
+	game.my_matter = 10;
+	game.opp_matter = 10;
+	Grid &grid = game.grid;
+	for (int i = 0; i < grid.size; i++)
+	{
+		int mirror = grid.size - 1 - i;
+		if (i > mirror)
+			grid.scrap[i] = grid.scrap[mirror];
+		else
+			grid.scrap[i] = rng() % 8 == 0 ? 0 : 1 + rng() % 10;
+	}
+	Position base = Position(1 + rng() % (width / 2 - 2), 1 + rng() % (height - 2));
+	Position bases[2];
+	bases[PLAYER_ME] = seed % 2 ? base : Position(width - 1 - base.x, height - 1 - base.y);
+	bases[PLAYER_OPPONENT] = Position(width - 1 - bases[PLAYER_ME].x, height - 1 - bases[PLAYER_ME].y);
+	for (int p = 0; p < 2; p++)
+	{
+		for (int dy = -1; dy <= 1; dy++)
+		{
+			for (int dx = -1; dx <= 1; dx++)
+			{
+				int index = grid.index(Position(bases[p].x + dx, bases[p].y + dy));
+				grid.owner[index] = p;
+				grid.scrap[index] = max((int)grid.scrap[index], 1);
+				grid.units[index] = abs(dx) + abs(dy) == 1 ? 1 : 0;
+			}
+		}
+	}
+	game.refresh_cases();
+	return game;
+}
+
+int count_cases(Game &game, Player owner)
+{
+	int count = 0;
+	for (int i = 0; i < game.grid.size; i++)
+	{
+		if (game.grid.owner[i] == owner)
+			count++;
+	}
+	return count;
+}
+
+// Show the board to one side the way the referee would: owners and matter
+// are swapped for the opponent so that PLAYER_ME is always the viewer.
+void load_view(Game &view, Game &world, Player viewer)
+{
+	view.grid = world.grid;
+	view.my_matter = viewer == PLAYER_ME ? world.my_matter : world.opp_matter;
+	view.opp_matter = viewer == PLAYER_ME ? world.opp_matter : world.my_matter;
+	if (viewer == PLAYER_OPPONENT)
+	{
+		for (int i = 0; i < view.grid.size; i++)
+		{
+			if (view.grid.owner[i] != PLAYER_NONE)
+				view.grid.owner[i] = view.grid.owner[i] == PLAYER_ME ? PLAYER_OPPONENT : PLAYER_ME;
+		}
+	}
+	view.refresh_cases();
+#if THREAT_SPAWNS
+	view.threats.observe(view.grid);
+#endif
+}
+
+// When `record` is given, every turn block shown to a player is appended
+// to it in the referee format; `replay` gets the same turns as binary frames
+MatchResult play_match(int seed, vector<string> *record = NULL, ReplayWriter *replay = NULL)
+{
+	MatchResult result;
+	result.seed = seed;
+	Game world = generate_map(seed);
+	Game views[2] = {Game(world.width, world.height), Game(world.width, world.height)};
+	Strategy strategies[2];
+	Planner planners[2];
+	TurnClock clock;
+	int stale = 0;
+	int last_cases[2] = {-1, -1};
+	while (result.turns < SELFPLAY_MAX_TURNS)
+	{
+		result.turns++;
+		ActionBuffer actions[2];
+		for (int p = 0; p < 2; p++)
+		{
+			load_view(views[p], world, (Player)p);
+			if (record != NULL)
+			{
+				ostringstream out;
+				views[p].write_inputs(out);
+				record->push_back(out.str());
+			}
+			if (replay != NULL)
+				replay->begin(views[p], result.turns, (Player)p);
+			clock.start(result.turns == 1 ? FIRST_TURN_BUDGET_MS : TURN_BUDGET_MS);
+			planners[p].plan(views[p], strategies[p], clock);
+			result.turn_latencies.push_back(clock.elapsed_us());
+			actions[p] = views[p].action_manager.actions;
+			if (replay != NULL)
+				replay->end(actions[p]);
+			views[p].action_manager.clear();
+		}
+		world.step(actions[PLAYER_ME], actions[PLAYER_OPPONENT]);
+		trace_flush();
+		int cases[2] = {count_cases(world, PLAYER_OPPONENT), count_cases(world, PLAYER_ME)};
+		if (cases[PLAYER_ME] == 0 || cases[PLAYER_OPPONENT] == 0)
+			break;
+		stale = (cases[0] == last_cases[0] && cases[1] == last_cases[1]) ? stale + 1 : 0;
+		if (stale >= SELFPLAY_STALE_TURNS)
+			break;
+		last_cases[0] = cases[0];
+		last_cases[1] = cases[1];
+	}
+	int mine = count_cases(world, PLAYER_ME);
+	int theirs = count_cases(world, PLAYER_OPPONENT);
+	if (mine != theirs)
+		result.winner = mine > theirs ? PLAYER_ME : PLAYER_OPPONENT;
+	return result;
+}
+
+// Usage: tools selfplay [games] [threads] [first_seed] [replay_dir]
+// Every worker pulls the next seed from a shared atomic cursor, so a slow
+// game never holds back the others. With a replay directory, each game is
+// also saved there as <seed>.replay.
+int run_selfplay(int argc, char **argv)
+{
+	int games = argc > 2 ? atoi(argv[2]) : 1000;
+	int threads = argc > 3 ? atoi(argv[3]) : (int)thread::hardware_concurrency();
+	int first_seed = argc > 4 ? atoi(argv[4]) : 1;
+	string replay_dir = argc > 5 ? argv[5] : "";
+	if (threads <= 0)
+		threads = 1;
+
+	atomic<int> next(0);
+	vector<vector<MatchResult> > results(threads);
+	vector<thread> workers;
+	auto start = chrono::steady_clock::now();
+	for (int t = 0; t < threads; t++)
+	{
+		workers.push_back(thread([&, t]()
+								 {
+									 for (int i = next++; i < games; i = next++)
+									 {
+										 if (replay_dir.empty())
+										 {
+											 results[t].push_back(play_match(first_seed + i));
+											 continue;
+										 }
+										 ReplayWriter replay;
+										 Game map = generate_map(first_seed + i);
+										 if (!replay.open(replay_dir + "/" + to_string(first_seed + i) + ".replay", map.width, map.height))
+											 cerr << "Can't write replays to " << replay_dir << endl;
+										 results[t].push_back(play_match(first_seed + i, NULL, replay.is_open() ? &replay : NULL));
+									 }
+								 }));
+	}
+	for (auto it = workers.begin(); it != workers.end(); it++)
+		it->join();
+	auto end = chrono::steady_clock::now();
+	trace_report();
+
+	int wins[3] = {0, 0, 0};
+	long long total_turns = 0;
+	vector<long long> latencies;
+	for (auto it = results.begin(); it != results.end(); it++)
+	{
+		for (auto it2 = it->begin(); it2 != it->end(); it2++)
+		{
+			wins[it2->winner + 1]++;
+			total_turns += it2->turns;
+			latencies.insert(latencies.end(), it2->turn_latencies.begin(), it2->turn_latencies.end());
+		}
+	}
+	sort(latencies.begin(), latencies.end());
+	long long sum = 0;
+	for (auto it = latencies.begin(); it != latencies.end(); it++)
+		sum += *it;
+
+	cout << "games: " << games << " on " << threads << " threads in " << chrono::duration_cast<chrono::milliseconds>(end - start).count() << " ms" << endl;
+	cout << "win rate: " << (games > 0 ? 100.0 * wins[PLAYER_ME + 1] / games : 0) << "% (wins " << wins[PLAYER_ME + 1] << ", losses " << wins[PLAYER_OPPONENT + 1] << ", draws " << wins[PLAYER_NONE + 1] << ")" << endl;
+	cout << "average game length: " << (games > 0 ? (double)total_turns / games : 0) << " turns" << endl;
+	if (latencies.size() > 0)
+	{
+		cout << "turn latency: avg " << (double)sum / latencies.size() << " us, p99 " << latencies[latencies.size() * 99 / 100] << " us, max " << latencies.back() << " us" << endl;
+	}
+	return 0;
+}
+
+/*=======================================================================
+||                                                                     ||
+||                              Benchmark                              ||
+||                                                                     ||
+=======================================================================*/
+
+#define BENCH_CORPUS_GAMES 20
+// regress fails when the total time grows by more than this percentage,
+// unless another limit is given on the command line
+#define REGRESS_MAX_SLOWDOWN 10.0
+#define REGRESS_WORST_TURNS 10
+
+enum BenchPhase
+{
+	BENCH_READ_INPUTS,
+	BENCH_TERITORIES,
+	BENCH_EXPAND_TERITORY,
+	BENCH_EXPAND_LINES,
+	BENCH_SPLATOON,
+	BENCH_RECYCLERS,
+	BENCH_TURN,
+	BENCH_ROLLOUT,
+	BENCH_TERITORY_UPDATE,
+	BENCH_PHASE_COUNT
+};
+
+const char *bench_phase_names[BENCH_PHASE_COUNT] = {"read_inputs", "get_teritories", "expand(teritory)", "expand(lines)", "splatoon", "recyclers", "full turn", "rollout", "update(teritory)"};
+
+// States sharing a sequence are the consecutive turns of one player
+class BenchState
+{
+public:
+	int width;
+	int height;
+	string turn;
+	int sequence;
+	BenchState(int width, int height, string turn, int sequence)
+	{
+		this->width = width;
+		this->height = height;
+		this->turn = turn;
+		this->sequence = sequence;
+	}
+};
+
+class BenchClock
+{
+public:
+	chrono::steady_clock::time_point start;
+	long long allocations;
+	BenchClock()
+	{
+		allocations = allocation_count;
+		start = chrono::steady_clock::now();
+	}
+	void stop(vector<long long> &times, vector<long long> &allocs)
+	{
+		auto end = chrono::steady_clock::now();
+		times.push_back(chrono::duration_cast<chrono::nanoseconds>(end - start).count());
+		allocs.push_back(allocation_count - allocations);
+	}
+};
+
+// A corpus file is a `width height` line followed by any number of turn
+// blocks, exactly as the referee writes them on stdin
+void load_corpus(string path, vector<BenchState> &corpus)
+{
+	ifstream in(path);
+	int width;
+	int height;
+	if (!(in >> width >> height))
+	{
+		cerr << "Can't read corpus " << path << endl;
+		return;
+	}
+	in.ignore();
+	// One sequence per file, apart from the self-play ones
+	int sequence = -1 - (int)corpus.size();
+	string line;
+	while (true)
+	{
+		string turn;
+		for (int i = 0; i < width * height + 1 && getline(in, line); i++)
+			turn += line + "\n";
+		if (count(turn.begin(), turn.end(), '\n') < width * height + 1)
+			break;
+		corpus.push_back(BenchState(width, height, turn, sequence));
+	}
+}
+
+void bench_state(BenchState &state, vector<long long> times[], vector<long long> allocs[])
+{
+	InputReader in(state.turn.data(), state.turn.size());
+	Game game(state.width, state.height);
+	BenchClock read_clock;
+	game.read_inputs(in);
+	read_clock.stop(times[BENCH_READ_INPUTS], allocs[BENCH_READ_INPUTS]);
+	if (game.my_bots.size() == 0)
+		return;
+
+	Strategy strategy;
+	strategy.init(game);
+	strategy.turn = 1;
+
+	BenchClock teritories_clock;
+	vector<Teritory> teritories = game.get_teritories();
+	teritories_clock.stop(times[BENCH_TERITORIES], allocs[BENCH_TERITORIES]);
+
+	Game copy = game;
+	BenchClock expand_clock;
+	for (auto it = copy.teritories.begin(); it != copy.teritories.end(); it++)
+	{
+		if (!it->isIsolateWithCase())
+			expand(copy, *it, strategy.spawn, strategy.middle, strategy.xDir);
+	}
+	expand_clock.stop(times[BENCH_EXPAND_TERITORY], allocs[BENCH_EXPAND_TERITORY]);
+	copy.action_manager.clear();
+
+	copy = game;
+	BenchClock lines_clock;
+	expand(copy, strategy.xDir, copy.my_bots);
+	lines_clock.stop(times[BENCH_EXPAND_LINES], allocs[BENCH_EXPAND_LINES]);
+	copy.action_manager.clear();
+
+	copy = game;
+	BenchClock splatoon_clock;
+	for (auto it = copy.teritories.begin(); it != copy.teritories.end(); it++)
+	{
+		if (it->my_bots.size() > 0)
+			splatoon(copy, *it);
+	}
+	splatoon_clock.stop(times[BENCH_SPLATOON], allocs[BENCH_SPLATOON]);
+	copy.action_manager.clear();
+
+	copy = game;
+	BenchClock recyclers_clock;
+	build_recyclers(copy);
+	recyclers_clock.stop(times[BENCH_RECYCLERS], allocs[BENCH_RECYCLERS]);
+	copy.action_manager.clear();
+
+	copy = game;
+	copy.teritories.clear();
+	BenchClock turn_clock;
+	strategy.play_turn(copy);
+	turn_clock.stop(times[BENCH_TURN], allocs[BENCH_TURN]);
+
+	// One planner node: the strategy's turn rolled forward
+	Planner planner;
+	BoardState root(game.grid, game.opp_matter, game.my_matter);
+	BenchClock rollout_clock;
+	planner.rollout(root, copy.action_manager.actions);
+	rollout_clock.stop(times[BENCH_ROLLOUT], allocs[BENCH_ROLLOUT]);
+	copy.action_manager.clear();
+}
+
+// Territories brought up to date from the previous turn of the same
+// player, the way the bot does it between turns; the first turn of a
+// sequence builds them and isn't timed
+void bench_updates(vector<BenchState> &corpus, vector<long long> &times, vector<long long> &allocs)
+{
+	map<int, Game> games;
+	for (auto it = corpus.begin(); it != corpus.end(); it++)
+	{
+		auto found = games.find(it->sequence);
+		if (found == games.end())
+			found = games.insert(make_pair(it->sequence, Game(it->width, it->height))).first;
+		Game &game = found->second;
+		InputReader in(it->turn.data(), it->turn.size());
+		game.read_inputs(in);
+		if (game.teritories.size() == 0)
+		{
+			game.build_teritories();
+			continue;
+		}
+		BenchClock clock;
+		game.update_teritories();
+		clock.stop(times, allocs);
+	}
+}
+
+// Usage: tools bench [corpus files...]
+// Without files, the corpus is made of the states seen during a few
+// self-play games.
+int run_bench(int argc, char **argv)
+{
+	vector<BenchState> corpus;
+	for (int i = 2; i < argc; i++)
+		load_corpus(argv[i], corpus);
+	if (argc <= 2)
+	{
+		for (int seed = 1; seed <= BENCH_CORPUS_GAMES; seed++)
+		{
+			vector<string> record;
+			Game map = generate_map(seed);
+			play_match(seed, &record);
+			// The record alternates the two players' views turn by turn
+			for (size_t i = 0; i < record.size(); i++)
+				corpus.push_back(BenchState(map.width, map.height, record[i], seed * 2 + i % 2));
+		}
+	}
+	// Rollouts are timed cold, not answered from the games above
+	transpositions.clear();
+
+	vector<long long> times[BENCH_PHASE_COUNT];
+	vector<long long> allocs[BENCH_PHASE_COUNT];
+	for (auto it = corpus.begin(); it != corpus.end(); it++)
+	{
+		bench_state(*it, times, allocs);
+		trace_flush();
+	}
+	bench_updates(corpus, times[BENCH_TERITORY_UPDATE], allocs[BENCH_TERITORY_UPDATE]);
+	trace_report();
+
+	cout << corpus.size() << " states" << endl;
+	cout << "phase               min(us)   median(us)      p99(us)      max(us)  allocs/turn" << endl;
+	for (int p = 0; p < BENCH_PHASE_COUNT; p++)
+	{
+		vector<long long> &t = times[p];
+		if (t.size() == 0)
+			continue;
+		sort(t.begin(), t.end());
+		long long total_allocs = 0;
+		for (auto it = allocs[p].begin(); it != allocs[p].end(); it++)
+			total_allocs += *it;
+		char line[160];
+		snprintf(line, sizeof(line), "%-16s %10.1f %12.1f %12.1f %12.1f %12.1f", bench_phase_names[p], t.front() / 1000.0, t[t.size() / 2] / 1000.0, t[t.size() * 99 / 100] / 1000.0, t.back() / 1000.0, (double)total_allocs / t.size());
+		cout << line << endl;
+	}
+	return 0;
+}
+
+// Usage: tools regress <replay_dir> <baseline> [save|<max slowdown %>]
+// Plays every recorded turn again through the planner, each game in order
+// with one Game and Strategy per player as in the match, and keeps the
+// wall time, allocations and a hash of the emitted command line. The
+// budget is the first-turn one so the search always completes and the
+// decisions don't depend on machine speed. Results are compared with the
+// baseline file, or written to it when it is missing or `save` is given;
+// the exit code is 1 when any decision changed or the total time grew by
+// more than the allowed slowdown.
+class RegressTurn
+{
+public:
+	uint64_t hash;
+	long long time_ns;
+	long long allocs;
+	RegressTurn()
+	{
+		hash = 0;
+		time_ns = 0;
+		allocs = 0;
+	}
+};
+
+uint64_t hash_text(const char *text, int size)
+{
+	uint64_t hash = 1469598103934665603ULL;
+	for (int i = 0; i < size; i++)
+		hash = (hash ^ (uint8_t)text[i]) * 1099511628211ULL;
+	return hash;
+}
+
+bool load_regress(string path, vector<RegressTurn> &turns)
+{
+	ifstream in(path);
+	int count;
+	if (!(in >> count))
+		return false;
+	turns.resize(count);
+	for (int i = 0; i < count; i++)
+		in >> hex >> turns[i].hash >> dec >> turns[i].time_ns >> turns[i].allocs;
+	return (bool)in;
+}
+
+void save_regress(string path, vector<RegressTurn> &turns)
+{
+	ofstream out(path);
+	out << turns.size() << "\n";
+	for (auto it = turns.begin(); it != turns.end(); it++)
+		out << hex << it->hash << dec << " " << it->time_ns << " " << it->allocs << "\n";
+}
+
+void regress_summary(const char *name, vector<RegressTurn> &turns, vector<long long> &times, long long &allocs)
+{
+	times.clear();
+	allocs = 0;
+	for (auto it = turns.begin(); it != turns.end(); it++)
+	{
+		times.push_back(it->time_ns);
+		allocs += it->allocs;
+	}
+	sort(times.begin(), times.end());
+	char line[160];
+	snprintf(line, sizeof(line), "%-9s median %8.1f us  p99 %8.1f us  max %8.1f us  allocs/turn %6.1f", name, times[times.size() / 2] / 1000.0, times[times.size() * 99 / 100] / 1000.0, times.back() / 1000.0, (double)allocs / turns.size());
+	cout << line << endl;
+}
+
+int run_regress(int argc, char **argv)
+{
+	if (argc < 4)
+	{
+		cerr << "Usage: tools regress <replay_dir> <baseline> [save|<max slowdown %>]" << endl;
+		return 1;
+	}
+	ReplayReader reader;
+	if (!reader.open(argv[2]) || reader.frames == 0)
+	{
+		cerr << "No replays in " << argv[2] << endl;
+		return 1;
+	}
+	vector<RegressTurn> turns(reader.frames);
+	int reproduced = 0;
+	char output[OUTPUT_BUFFER_SIZE];
+	for (auto file = reader.files.begin(); file != reader.files.end(); file++)
+	{
+		Game games[2] = {Game(file->width, file->height), Game(file->width, file->height)};
+		Strategy strategies[2];
+		Planner planners[2];
+		TurnClock clock;
+		for (int frame = file->first; frame < file->first + file->frames; frame++)
+		{
+			int p = reader.header(frame).viewer;
+			reader.load(frame, games[p]);
+			long long allocations = allocation_count;
+			clock.start(FIRST_TURN_BUDGET_MS);
+			planners[p].plan(games[p], strategies[p], clock);
+			turns[frame].time_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - clock.started).count();
+			turns[frame].allocs = allocation_count - allocations;
+			turns[frame].hash = hash_text(output, games[p].action_manager.serialize(output, sizeof(output)));
+			reader.actions(frame, games[p].action_manager.actions);
+			if (hash_text(output, games[p].action_manager.serialize(output, sizeof(output))) == turns[frame].hash)
+				reproduced++;
+			games[p].action_manager.clear();
+			trace_flush();
+		}
+	}
+	trace_report();
+
+	vector<long long> times;
+	long long allocs;
+	cout << reader.frames << " turns from " << reader.files.size() << " replays, " << reproduced << " reproduce the recording" << endl;
+	regress_summary("current", turns, times, allocs);
+	cout << "transpositions: " << transpositions.hits << " hits of " << transpositions.probes << " rollouts" << endl;
+	vector<RegressTurn> baseline;
+	bool save = argc > 4 && string(argv[4]) == "save";
+	double max_slowdown = argc > 4 && !save ? atof(argv[4]) : REGRESS_MAX_SLOWDOWN;
+	if (save || !load_regress(argv[3], baseline))
+	{
+		save_regress(argv[3], turns);
+		cout << "baseline saved to " << argv[3] << endl;
+		return 0;
+	}
+	if (baseline.size() != turns.size())
+	{
+		cerr << "Baseline has " << baseline.size() << " turns, corpus has " << turns.size() << endl;
+		return 1;
+	}
+	vector<long long> baseline_times;
+	long long baseline_allocs;
+	regress_summary("baseline", baseline, baseline_times, baseline_allocs);
+	long long total = 0;
+	long long baseline_total = 0;
+	for (size_t i = 0; i < turns.size(); i++)
+	{
+		total += turns[i].time_ns;
+		baseline_total += baseline[i].time_ns;
+	}
+	double slowdown = baseline_total > 0 ? 100.0 * (total - baseline_total) / baseline_total : 0;
+	cout << "total time " << slowdown << "% against baseline (limit " << max_slowdown << "%)" << endl;
+
+	// The turns that lost the most time, slowest first
+	vector<int> worst;
+	for (int frame = 0; frame < reader.frames; frame++)
+	{
+		if (turns[frame].time_ns > baseline[frame].time_ns)
+			worst.push_back(frame);
+	}
+	sort(worst.begin(), worst.end(), [&](int a, int b) { return turns[a].time_ns - baseline[a].time_ns > turns[b].time_ns - baseline[b].time_ns; });
+	if ((int)worst.size() > REGRESS_WORST_TURNS)
+		worst.resize(REGRESS_WORST_TURNS);
+	for (auto it = worst.begin(); it != worst.end(); it++)
+	{
+		char line[256];
+		snprintf(line, sizeof(line), "slower: frame %d (%s turn %d player %d) %8.1f us -> %8.1f us", *it, reader.file_of(*it).path.c_str(), reader.header(*it).turn, reader.header(*it).viewer, baseline[*it].time_ns / 1000.0, turns[*it].time_ns / 1000.0);
+		cout << line << endl;
+	}
+
+	int changed = 0;
+	for (int frame = 0; frame < reader.frames; frame++)
+	{
+		if (turns[frame].hash == baseline[frame].hash)
+			continue;
+		if (changed++ < 20)
+			cout << "changed: frame " << frame << " (" << reader.file_of(frame).path << " turn " << reader.header(frame).turn << " player " << (int)reader.header(frame).viewer << ")" << endl;
+	}
+	cout << "decisions: " << changed << " of " << reader.frames << " turns changed" << endl;
+	if (slowdown > max_slowdown)
+		cout << "too slow: " << slowdown << "% over the " << max_slowdown << "% limit" << endl;
+	return changed > 0 || slowdown > max_slowdown ? 1 : 0;
+}
+
+// Usage: tools dump <seed>
+// Writes the states of one self-play game as a corpus file for bench
+int run_dump(int argc, char **argv)
+{
+	int seed = argc > 2 ? atoi(argv[2]) : 1;
+	vector<string> record;
+	Game map = generate_map(seed);
+	play_match(seed, &record);
+	cout << map.width << " " << map.height << "\n";
+	for (auto it = record.begin(); it != record.end(); it++)
+		cout << *it;
+	return 0;
+}
+
+// Usage: tools replay <dir> [frame]
+// Lists the recorded frames, or shows one frame with the actions recorded
+// for it next to what the current strategy plays there
+int run_replay(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		cerr << "Usage: tools replay <dir> [frame]" << endl;
+		return 1;
+	}
+	ReplayReader reader;
+	if (!reader.open(argv[2]))
+	{
+		cerr << "Can't open " << argv[2] << endl;
+		return 1;
+	}
+	if (argc < 4)
+	{
+		for (auto it = reader.files.begin(); it != reader.files.end(); it++)
+			cout << it->path << ": " << it->width << "x" << it->height << ", frames " << it->first << " to " << it->first + it->frames - 1 << endl;
+		cout << reader.frames << " frames" << endl;
+		return 0;
+	}
+	int frame = atoi(argv[3]);
+	if (frame < 0 || frame >= reader.frames)
+	{
+		cerr << "No frame " << frame << endl;
+		return 1;
+	}
+	ReplayReader::File &file = reader.file_of(frame);
+	ReplayFrameHeader info = reader.header(frame);
+	Game game(file.width, file.height);
+	reader.load(frame, game);
+	cout << file.path << " turn " << info.turn << " player " << (int)info.viewer << endl;
+	game.write_inputs(cout);
+
+	char output[OUTPUT_BUFFER_SIZE];
+	reader.actions(frame, game.action_manager.actions);
+	cout << "recorded: ";
+	cout.write(output, game.action_manager.serialize(output, sizeof(output)));
+	game.action_manager.clear();
+	Strategy strategy;
+	strategy.init(game);
+	strategy.turn = info.turn - 1;
+	strategy.play_turn(game);
+	cout << "strategy: ";
+	cout.write(output, game.action_manager.serialize(output, sizeof(output)));
+	return 0;
+}
+
+
+/*=======================================================================
+||                                                                     ||
+||                           Main Function                             ||
+||                                                                     ||
+=======================================================================*/
+
+int main(int argc, char **argv)
+{
+	trace_configure(getenv("BOT_TRACE"));
+	string mode = argc > 1 ? argv[1] : "";
+	if (mode == "selfplay")
+		return run_selfplay(argc, argv);
+	if (mode == "bench")
+		return run_bench(argc, argv);
+	if (mode == "dump")
+		return run_dump(argc, argv);
+	if (mode == "replay")
+		return run_replay(argc, argv);
+	if (mode == "regress")
+		return run_regress(argc, argv);
+	cerr << "Usage: tools selfplay|bench|dump|replay|regress ..." << endl;
+	return 1;
+}